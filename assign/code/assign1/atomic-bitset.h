@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Convenience Class: atomicBitset
+ * -------------------------------
+ * A fixed-size bitset that any number of threads can test and set
+ * concurrently without a lock.  Each bit lives in a 64-bit word that's
+ * updated with an atomic fetch_or, so exactly one of several threads racing
+ * to set the same bit is told that it was the one that set it.
+ */
+class atomicBitset {
+ public:
+  atomicBitset(size_t numBits) : words((numBits + kBitsPerWord - 1) / kBitsPerWord) {}
+
+  /**
+   * Method: test
+   * ------------
+   * Returns true if and only if the specified bit is set.
+   */
+  bool test(size_t bit) const {
+    return words[bit / kBitsPerWord].load(std::memory_order_relaxed) & mask(bit);
+  }
+
+  /**
+   * Method: testAndSet
+   * ------------------
+   * Sets the specified bit, and returns true if and only if this call
+   * is the one that changed it from clear to set.
+   */
+  bool testAndSet(size_t bit) {
+    std::atomic<uint64_t>& word = words[bit / kBitsPerWord];
+    if (word.load(std::memory_order_relaxed) & mask(bit)) return false;
+    return !(word.fetch_or(mask(bit), std::memory_order_relaxed) & mask(bit));
+  }
+
+ private:
+  static const size_t kBitsPerWord = 64;
+  static uint64_t mask(size_t bit) { return uint64_t(1) << (bit % kBitsPerWord); }
+  std::vector<std::atomic<uint64_t>> words;
+
+  atomicBitset(const atomicBitset& original) = delete;
+  atomicBitset& operator=(const atomicBitset& rhs) = delete;
+};
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "imdb.h"
+using namespace std;
+
+static const int kWrongArgumentCount = 1;
+static const int kDatabaseNotFound = 2;
+static const int kIndexNotWritten = 3;
+
+/**
+ * Function: collectCostars
+ * ------------------------
+ * Populates edges with one entry for every other player the specified actor
+ * has appeared with, paired with the first film (in credit order) they
+ * share.  The edges are sorted by actor id so that scans are sequential.
+ */
+static void collectCostars(const imdb& db, int actorId, vector<costar>& edges) {
+  edges.clear();
+  for (int filmId: db.getCreditIds(actorId)) {
+    for (int other: db.getCastIds(filmId)) {
+      if (other != actorId) edges.push_back(costar { other, filmId });
+    }
+  }
+
+  stable_sort(edges.begin(), edges.end(), [](const costar& a, const costar& b) {
+    return a.actorId < b.actorId;
+  });
+  edges.erase(unique(edges.begin(), edges.end(), [](const costar& a, const costar& b) {
+    return a.actorId == b.actorId;
+  }), edges.end());
+}
+
+/**
+ * Function: writeInts
+ * -------------------
+ * Self-explanatory.
+ */
+static void writeInts(ofstream& out, const int *ints, size_t count) {
+  out.write((const char *) ints, count * sizeof(int));
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc > 2) {
+    cerr << "Usage: " << argv[0] << " [<data-directory>]" << endl;
+    return kWrongArgumentCount;
+  }
+
+  const string directory = argc == 2 ? argv[1] : kIMDBDataDirectory;
+  imdb db(directory, imdb::kAdviseMap);
+  if (!db.good()) {
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
+  }
+
+  db.advise(imdb::kSequentialAccess);
+  idRange all = db.getAllActorIds();
+  vector<int> rows(all.begin(), all.end());
+  sort(rows.begin(), rows.end());
+
+  // the edges are streamed to a scratch file and stitched in behind the header
+  // and row tables at the end, since the edge count isn't known up front.
+  const string fileName = directory + "/" + imdb::kCostarFileName;
+  const string edgeFileName = fileName + ".edges";
+  ofstream edgeFile(edgeFileName, ios::binary | ios::trunc);
+  vector<int> starts;
+  vector<costar> edges;
+  int numEdges = 0;
+  for (int actorId: rows) {
+    starts.push_back(numEdges);
+    collectCostars(db, actorId, edges);
+    edgeFile.write((const char *) edges.data(), edges.size() * sizeof(costar));
+    numEdges += edges.size();
+  }
+  starts.push_back(numEdges);
+  edgeFile.close();
+
+  ofstream out(fileName, ios::binary | ios::trunc);
+  int header[] = {
+    (int) db.getActorIdBound(), (int) db.getFilmIdBound(), (int) rows.size(), numEdges
+  };
+  writeInts(out, header, 4);
+  writeInts(out, rows.data(), rows.size());
+  writeInts(out, starts.data(), starts.size());
+  ifstream in(edgeFileName, ios::binary);
+  out << in.rdbuf();
+  in.close();
+  remove(edgeFileName.c_str());
+  if (!out) {
+    cerr << "Couldn't write " << fileName << "." << endl;
+    return kIndexNotWritten;
+  }
+
+  cout << "Wrote " << fileName << ": " << rows.size() << " actors, "
+       << numEdges << " co-star edges." << endl;
+  return 0;
+}
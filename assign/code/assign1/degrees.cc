@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip> // for setw formatter
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "imdb.h"
+#include "six-degrees.h"
+using namespace std;
+
+static const int kWrongArgumentCount = 1;
+static const int kDatabaseNotFound = 2;
+static const int kActorNotFound = 3;
+static const int kDumpFileNotWritten = 4;
+
+/**
+ * Function: printHistogram
+ * ------------------------
+ * Publishes how many players sit at each degree of separation from the
+ * hub, along with a bar scaled against the most populous degree, the
+ * hub's eccentricity, the mean distance to the players it reaches, and
+ * how many players it doesn't reach at all.
+ */
+static void printHistogram(const string& hub, const vector<vector<int>>& levels, size_t numActors) {
+  const size_t kBarWidth = 50;
+  size_t widest = 0, reached = 0, totalDistance = 0;
+  for (size_t d = 0; d < levels.size(); d++) {
+    widest = max(widest, levels[d].size());
+    reached += levels[d].size();
+    totalDistance += d * levels[d].size();
+  }
+
+  cout << "Degrees of separation from " << hub << ":" << endl << endl;
+  for (size_t d = 0; d < levels.size(); d++) {
+    cout << setw(5) << d << " " << setw(10) << levels[d].size() << " "
+         << string(max<size_t>(levels[d].size() * kBarWidth / widest, 1), '#') << endl;
+  }
+  cout << endl;
+  cout << "  " << reached << " of " << numActors << " players are reachable, "
+       << numActors - reached << " are not." << endl;
+  cout << "  Eccentricity " << levels.size() - 1 << ", mean distance " << fixed << setprecision(3)
+       << (reached > 1 ? (double) totalDistance / (reached - 1) : 0.0) << "." << endl;
+}
+
+/**
+ * Function: writeDump
+ * -------------------
+ * Writes one line per reachable player to the named file, giving the
+ * degree and then the name, separated by a tab, in order of degree.
+ */
+static bool writeDump(const imdb& db, const vector<vector<int>>& levels, const string& fileName) {
+  ofstream dump(fileName);
+  for (size_t d = 0; d < levels.size() && dump; d++) {
+    for (int actorId: levels[d])
+      dump << d << '\t' << db.getActorNameView(actorId) << '\n';
+  }
+  return bool(dump);
+}
+
+static void printUsage(const char *progname) {
+  cerr << "Usage: " << progname << " [-j <threads>] <actor> [<dump-file>]" << endl;
+}
+
+int main(int argc, const char *argv[]) {
+  size_t numThreads = max(1u, thread::hardware_concurrency());
+  int i = 1;
+  if (i + 1 < argc && string(argv[i]) == "-j") {
+    if (atoi(argv[i + 1]) <= 0) {
+      printUsage(argv[0]);
+      return kWrongArgumentCount;
+    }
+    numThreads = atoi(argv[i + 1]);
+    i += 2;
+  }
+  if (argc - i < 1 || argc - i > 2) {
+    printUsage(argv[0]);
+    return kWrongArgumentCount;
+  }
+
+  imdb db(kIMDBDataDirectory, imdb::kAdviseMap);
+  if (!db.good()) {
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
+  }
+
+  const string hub = argv[i];
+  vector<vector<int>> levels;
+  auto start = chrono::steady_clock::now();
+  if (!singleSourceLevels(db, hub, levels, numThreads)) {
+    cerr << "We're sorry, but " << hub << " doesn't appear to be in our database." << endl;
+    return kActorNotFound;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  printHistogram(hub, levels, db.getAllActorIds().size());
+  cout << "  Computed in " << setprecision(3) << elapsed.count() << " s using "
+       << numThreads << " threads." << endl;
+
+  if (i + 1 < argc && !writeDump(db, levels, argv[i + 1])) {
+    cerr << "Couldn't write " << argv[i + 1] << "." << endl;
+    return kDumpFileNotWritten;
+  }
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 #include "imdb.h"
@@ -9,11 +11,14 @@ using namespace std;
 
 const char *const imdb::kActorFileName = "actordata";
 const char *const imdb::kMovieFileName = "moviedata";
-imdb::imdb(const string& directory) {
+const char *const imdb::kCostarFileName = "costardata";
+imdb::imdb(const string& directory, mapMode mode) : stopPrefaulting(false) {
     const string actorFileName = directory + "/" + kActorFileName;
     const string movieFileName = directory + "/" + kMovieFileName;
-    actorFile = acquireFileMap(actorFileName, actorInfo);
-    movieFile = acquireFileMap(movieFileName, movieInfo);
+    actorFile = acquireFileMap(actorFileName, actorInfo, mode);
+    movieFile = acquireFileMap(movieFileName, movieInfo, mode);
+    acquireCostarIndex(directory + "/" + kCostarFileName, mode);
+    if (mode == kPrefaultMap && good()) prefaulter = thread([this] { prefault(); });
 }
 
 bool imdb::good() const {
@@ -21,90 +26,318 @@ bool imdb::good() const {
 }
 
 imdb::~imdb() {
+    stopPrefaulting = true;
+    if (prefaulter.joinable()) prefaulter.join();
     releaseFileMap(actorInfo);
     releaseFileMap(movieInfo);
+    releaseFileMap(costarInfo);
 }
 
 string imdb::getActorName(const int offset) const {
-    return string((char *) actorFile + offset);
+    return string(getActorNameView(offset));
 }
 
 film imdb::getFilmData(const int offset) const {
-    char *film_ptr = (char *) movieFile + offset;
-    const string filmName = string(film_ptr);
-    film_ptr += filmName.length() + 1;
-    char year = *film_ptr;
-    return film { filmName, year };
+    return film { string(getFilmTitleView(offset)), getFilmYear(offset) };
 }
 
-bool imdb::getCredits(const string& player, vector<film>& films) const {
+string_view imdb::getActorNameView(int actorId) const {
+    return string_view((const char *) actorFile + actorId);
+}
+
+string_view imdb::getFilmTitleView(int filmId) const {
+    return string_view((const char *) movieFile + filmId);
+}
+
+int imdb::getFilmYear(int filmId) const {
+    // the year byte sits just past the title's '\0'
+    const char *title = (const char *) movieFile + filmId;
+    return title[getFilmTitleView(filmId).size() + 1];
+}
+
+idRange imdb::getAllActorIds() const {
     const int *countp = (const int *) actorFile;
-    const int *begin = (const int *) actorFile + 1;
-    const int *end = begin + *countp;
-    const int *found = lower_bound(begin, end, player, [this](const int offset, const string& b) {
-        return getActorName(offset).compare(b) < 0;
+    return idRange(countp + 1, countp + 1 + *countp);
+}
+
+idRange imdb::getAllFilmIds() const {
+    const int *countp = (const int *) movieFile;
+    return idRange(countp + 1, countp + 1 + *countp);
+}
+
+int imdb::getActorId(const string& player) const {
+    idRange all = getAllActorIds();
+    const int *found = lower_bound(all.begin(), all.end(), player, [this](const int offset, const string& b) {
+        return getActorNameView(offset) < b;
     });
-    // if the player is not in the actorFile return false
-    if (getActorName(*found).compare(player) != 0) return false;
-    
-    // Otherwise, proceed with the actor's record
-    char* actorRecord = (char *) actorFile + *found;
-    int numOfByte = 0;
-    if (player.length() % 2) {
-        numOfByte += (player.length() + 1);
-    } else {
-        numOfByte += (player.length() + 2);
-    }
-    actorRecord += numOfByte;
-    short* listMovie = (short *) actorRecord;
-    if (numOfByte % 4) actorRecord += 2;
-    else actorRecord += 4;
-        
-    for (short i=0; i < *listMovie; i++) {
-        int* movie = (int *) actorRecord;
-        films.push_back(getFilmData(*movie));
-        actorRecord += 4;
+    if (found == all.end() || getActorNameView(*found) != player) return kNoRecord;
+    return *found;
+}
+
+/**
+ * Orders the film stored at the specified id against movie without
+ * building a film (and the string inside it) for the stored one.
+ */
+static int compareFilm(string_view title, int year, const film& movie) {
+    int cmp = title.compare(movie.title);
+    if (cmp != 0) return cmp;
+    return year - movie.year;
+}
+
+int imdb::getFilmId(const film& movie) const {
+    idRange all = getAllFilmIds();
+    const int *found = lower_bound(all.begin(), all.end(), movie, [this](const int offset, const film& b) {
+        return compareFilm(getFilmTitleView(offset), getFilmYear(offset), b) < 0;
+    });
+    if (found == all.end() ||
+        compareFilm(getFilmTitleView(*found), getFilmYear(*found), movie) != 0) return kNoRecord;
+    return *found;
+}
+
+/**
+ * Actor and movie records share a layout: a '\0'-terminated name, fixedBytes
+ * of extra data (the year, for movies), padding to an even length, a short
+ * count, padding to a multiple of four, and then count int offsets into
+ * the other file.
+ */
+const int *imdb::getRecordIds(const void *file, int offset, int fixedBytes, short& count) {
+    const char *record = (const char *) file + offset;
+    int skipBytes = strlen(record) + 1 + fixedBytes;
+    if (skipBytes % 2) skipBytes++;
+    count = *(const short *) (record + skipBytes);
+    skipBytes += sizeof(short);
+    if (skipBytes % 4) skipBytes += 2;
+    return (const int *) (record + skipBytes);
+}
+
+idRange imdb::getCreditIds(int actorId) const {
+    short numFilms;
+    const int *ids = getRecordIds(actorFile, actorId, 0, numFilms);
+    return idRange(ids, ids + numFilms);
+}
+
+idRange imdb::getCastIds(int filmId) const {
+    short numActors;
+    const int *ids = getRecordIds(movieFile, filmId, 1, numActors);
+    return idRange(ids, ids + numActors);
+}
+
+/**
+ * Compares the first n characters of a and b (or all of them, if either
+ * is shorter) without regard to case.  Ordering is as for strcmp.
+ */
+static int compareFolded(string_view a, string_view b, size_t n = string_view::npos) {
+    size_t len = min(min(a.size(), b.size()), n);
+    for (size_t i = 0; i < len; i++) {
+        int ca = tolower((unsigned char) a[i]), cb = tolower((unsigned char) b[i]);
+        if (ca != cb) return ca - cb;
     }
+    if (len == n) return 0;
+    return a.size() < b.size() ? -1 : a.size() > b.size();
+}
+
+idRange imdb::getActorIdsByPrefix(string_view prefix) const {
+    idRange all = getAllActorIds();
+    const int *first = lower_bound(all.begin(), all.end(), prefix, [this](int offset, string_view b) {
+        return getActorNameView(offset) < b;
+    });
+    const int *last = upper_bound(first, all.end(), prefix, [this](string_view b, int offset) {
+        return b < getActorNameView(offset).substr(0, b.size());
+    });
+    return idRange(first, last);
+}
+
+const vector<int>& imdb::getActorOrdinals() const {
+    call_once(actorOrdinalsBuilt, [this] {
+        idRange all = getAllActorIds();
+        actorOrdinals.assign(getActorIdBound(), int(kNoRecord));
+        for (size_t i = 0; i < all.size(); i++) actorOrdinals[all[i]] = i;
+    });
+    return actorOrdinals;
+}
+
+const vector<int>& imdb::getFoldedActorIds() const {
+    call_once(foldedActorIdsBuilt, [this] {
+        idRange all = getAllActorIds();
+        foldedActorIds.assign(all.begin(), all.end());
+        stable_sort(foldedActorIds.begin(), foldedActorIds.end(), [this](int a, int b) {
+            return compareFolded(getActorNameView(a), getActorNameView(b)) < 0;
+        });
+    });
+    return foldedActorIds;
+}
+
+idRange imdb::getActorIdsByFoldedPrefix(string_view prefix) const {
+    const vector<int>& folded = getFoldedActorIds();
+    auto first = lower_bound(folded.begin(), folded.end(), prefix, [this](int offset, string_view b) {
+        return compareFolded(getActorNameView(offset), b, b.size()) < 0;
+    });
+    auto last = upper_bound(first, folded.end(), prefix, [this](string_view b, int offset) {
+        return compareFolded(b, getActorNameView(offset), b.size()) < 0;
+    });
+    return idRange(folded.data() + (first - folded.begin()), folded.data() + (last - folded.begin()));
+}
+
+idRange imdb::getActorIdsByFoldedName(string_view name) const {
+    const vector<int>& folded = getFoldedActorIds();
+    auto first = lower_bound(folded.begin(), folded.end(), name, [this](int offset, string_view b) {
+        return compareFolded(getActorNameView(offset), b) < 0;
+    });
+    auto last = upper_bound(first, folded.end(), name, [this](string_view b, int offset) {
+        return compareFolded(b, getActorNameView(offset)) < 0;
+    });
+    return idRange(folded.data() + (first - folded.begin()), folded.data() + (last - folded.begin()));
+}
+
+costarRange imdb::getCostars(int actorId) const {
+    if (costarFile == NULL) return costarRange(NULL, NULL);
+    const int *header = (const int *) costarFile;
+    const int numRows = header[2];
+    const int *rows = header + 4;
+    const int *starts = rows + numRows;
+    const costar *edges = (const costar *) (starts + numRows + 1);
+    const int *found = lower_bound(rows, rows + numRows, actorId);
+    if (found == rows + numRows || *found != actorId) return costarRange(NULL, NULL);
+    size_t row = found - rows;
+    return costarRange(edges + starts[row], edges + starts[row + 1]);
+}
+
+void imdb::getCredits(int actorId, vector<int>& filmIds) const {
+    idRange ids = getCreditIds(actorId);
+    filmIds.assign(ids.begin(), ids.end());
+}
+
+void imdb::getCast(int filmId, vector<int>& actorIds) const {
+    idRange ids = getCastIds(filmId);
+    actorIds.assign(ids.begin(), ids.end());
+}
+
+bool imdb::getCredits(const string& player, vector<film>& films) const {
+    int actorId = getActorId(player);
+    if (actorId == kNoRecord) return false;
+    for (int filmId: getCreditIds(actorId))
+        films.push_back(getFilmData(filmId));
     return true;
 }
 
 bool imdb::getCast(const film& movie, vector<string>& players) const {
-    const int* numOfMovie = (int *) movieFile;
-    const int* begin = (int *) movieFile + 1;
-    const int* end = (int *) movieFile + *numOfMovie;
-    const int* found = lower_bound(begin, end, movie, [this](const int offset, const film& b) {
-        return getFilmData(offset) < b;
-    }); 
-    if (movie == getFilmData(*found)) {
-        char* film = (char *) movieFile + *found;
-        string filmName = string(film);
-        // cout << filmName << '\n';
-        int skipBytes = filmName.length() + 2;
-
-        if (skipBytes % 2) skipBytes++;
-
-        short* numOfActors = (short*) (film + skipBytes);
-        // cout << *numOfActors << '\n';
-        if (skipBytes % 4) skipBytes += 2;
-        else skipBytes += 4;
-        // cout << skipBytes << '\n';
-        film += skipBytes;
-        for (short i = 0; i<*numOfActors; i++) {
-            int* filmN = (int *) film;
-            players.push_back(getActorName(*filmN));
-            film += 4;
-        }
-        return true;
-    }
-    return false;
+    int filmId = getFilmId(movie);
+    if (filmId == kNoRecord) return false;
+    for (int actorId: getCastIds(filmId))
+        players.push_back(getActorName(actorId));
+    return true;
 }
 
-const void *imdb::acquireFileMap(const string& fileName, struct fileInfo& info) {
+/**
+ * Any failure along the way (a missing or unreadable file, one too short
+ * to hold even its record count, or a failed mmap) leaves info describing
+ * no file at all, with fd set to -1 so that good() reports the problem.
+ */
+const void *imdb::acquireFileMap(const string& fileName, struct fileInfo& info, mapMode mode) {
+    info = { -1, 0, NULL };
     struct stat stats;
-    stat(fileName.c_str(), &stats);
+    if (stat(fileName.c_str(), &stats) == -1 || stats.st_size < (off_t) sizeof(int)) return NULL;
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) return NULL;
+
+    int flags = MAP_SHARED;
+    if (mode == kPopulateMap) flags |= MAP_POPULATE;
+    void *map = mmap(0, stats.st_size, PROT_READ, flags, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (mode != kLazyMap) {
+        madvise(map, stats.st_size, MADV_WILLNEED);
+        madvise(map, stats.st_size, MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+        // only honored for files when the kernel has read-only THP for page cache
+        madvise(map, stats.st_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    info.fd = fd;
     info.fileSize = stats.st_size;
-    info.fd = open(fileName.c_str(), O_RDONLY);
-    return info.fileMap = mmap(0, info.fileSize, PROT_READ, MAP_SHARED, info.fd, 0);
+    return info.fileMap = map;
+}
+
+void imdb::advise(accessHint hint) const {
+    int advice = hint == kSequentialAccess ? MADV_SEQUENTIAL : MADV_RANDOM;
+    for (const fileInfo *info: { &actorInfo, &movieInfo, &costarInfo }) {
+        if (info->fileMap != NULL) madvise((void *) info->fileMap, info->fileSize, advice);
+    }
+}
+
+/**
+ * Touches one byte of every page of every mapped file, so they're all
+ * resident by the time queries get to them.  Queries can proceed while
+ * this runs, and the destructor cuts it short if it's still going.
+ */
+void imdb::prefault() {
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    for (const fileInfo *info: { &actorInfo, &movieInfo, &costarInfo }) {
+        const volatile char *bytes = (const volatile char *) info->fileMap;
+        for (size_t offset = 0; bytes != NULL && offset < info->fileSize; offset += pageSize) {
+            if (stopPrefaulting) return;
+            (void) bytes[offset];
+        }
+    }
+}
+
+/**
+ * The co-star index is optional, so it's only mapped if it's there, and
+ * it's dropped if it was built from some other version of the data files.
+ */
+void imdb::acquireCostarIndex(const string& fileName, mapMode mode) {
+    costarInfo = { -1, 0, NULL };
+    costarFile = NULL;
+    if (!good() || access(fileName.c_str(), R_OK) != 0) return;
+    const int *header = (const int *) acquireFileMap(fileName, costarInfo, mode);
+    if (header == NULL || !costarIndexIsSound(header, costarInfo.fileSize)) {
+        releaseFileMap(costarInfo);
+        costarInfo = { -1, 0, NULL };
+        return;
+    }
+    costarFile = header;
+}
+
+/**
+ * Checks that a co-star index of fileSize bytes is laid out the way
+ * getCostars expects: a four-int header (the two data file sizes, the number
+ * of rows and the number of edges), the rows, numRows + 1 starts running
+ * from 0 up to the number of edges, and the edges, with nothing after them.
+ * The rows have to be in strictly ascending order, since getCostars binary
+ * searches them, and every actor id stored (row or edge) has to be one of
+ * this imdb's actors and every film id has to fall within the movie file,
+ * since callers use them as record offsets and index arrays by them.
+ * Anything else (a truncated or corrupt file, or one built from other data
+ * files) would send lookups past the end of the mappings.
+ */
+bool imdb::costarIndexIsSound(const int *header, size_t fileSize) const {
+    if (fileSize < 4 * sizeof(int)) return false;
+    if ((size_t) header[0] != getActorIdBound() || (size_t) header[1] != getFilmIdBound()) return false;
+    const int numRows = header[2], numEdges = header[3];
+    if (numRows < 0 || numEdges < 0 ||
+        fileSize != 4 * sizeof(int) + sizeof(int) * (2 * (size_t) numRows + 1) +
+                    sizeof(costar) * (size_t) numEdges) return false;
+    const vector<int>& ordinals = getActorOrdinals();
+    auto isActor = [&](int id) {
+        return id >= 0 && (size_t) id < ordinals.size() && ordinals[id] != kNoRecord;
+    };
+    const int *rows = header + 4;
+    const int *starts = rows + numRows;
+    const costar *edges = (const costar *) (starts + numRows + 1);
+    if (starts[0] != 0 || starts[numRows] != numEdges) return false;
+    for (int row = 0; row < numRows; row++) {
+        if (!isActor(rows[row]) || (row > 0 && rows[row - 1] >= rows[row])) return false;
+        if (starts[row] > starts[row + 1]) return false;
+    }
+    for (int edge = 0; edge < numEdges; edge++) {
+        if (!isActor(edges[edge].actorId)) return false;
+        if (edges[edge].filmId < 0 || (size_t) edges[edge].filmId >= getFilmIdBound()) return false;
+    }
+    return true;
 }
 
 void imdb::releaseFileMap(struct fileInfo& info) {
@@ -1,8 +1,49 @@
 #pragma once
 #include "imdb-utils.h"
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+/**
+ * Convenience Struct: costar
+ * --------------------------
+ * One edge of the precomputed co-star graph: a player, and one film
+ * through which they're connected to the player whose edge it is.
+ */
+struct costar {
+  int actorId;
+  int filmId;
+};
+
+/**
+ * Convenience Class: mappedRange
+ * ------------------------------
+ * A read-only view of a run of records (ids, or costar edges) stored
+ * contiguously inside one of the imdb's memory-mapped files.  Iterating
+ * over one allocates nothing, and it's only valid for as long as the imdb
+ * that produced it is alive.
+ */
+template <typename T>
+class mappedRange {
+ public:
+  mappedRange(const T *first, const T *last) : first(first), last(last) {}
+  const T *begin() const { return first; }
+  const T *end() const { return last; }
+  size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+  const T& operator[](size_t i) const { return first[i]; }
+
+ private:
+  const T *first;
+  const T *last;
+};
+
+typedef mappedRange<int> idRange;
+typedef mappedRange<costar> costarRange;
+
 class imdb {
  public:
   
@@ -15,10 +56,23 @@ class imdb {
  * all of the information about the movies and actors relevant to an IMDB
  * application (like six-degrees).
  *
+ * The mode controls how the data files are brought into memory:
+ *
+ *     kLazyMap      plain mmap, so every page faults in the first time a query touches it.
+ *     kAdviseMap    also asks the kernel to start reading the files in right away
+ *                   (MADV_WILLNEED), without readahead on later faults (MADV_RANDOM),
+ *                   and in huge pages where the kernel supports that for files.
+ *     kPopulateMap  as kAdviseMap, but the constructor doesn't return until every
+ *                   page is resident (MAP_POPULATE).
+ *     kPrefaultMap  as kAdviseMap, plus a background thread that touches every page,
+ *                   so queries can start right away while the rest is faulted in.
+ *
  * @param directory the name of the directory housing the formatted information backing the imdb.
+ * @param mode one of the map modes above.
  */
 
-  imdb(const std::string& directory);
+  enum mapMode { kLazyMap, kAdviseMap, kPopulateMap, kPrefaultMap };
+  imdb(const std::string& directory, mapMode mode = kLazyMap);
 
 /**
  * Predicate Method: good
@@ -29,10 +83,23 @@ class imdb {
  *     1.) either one or both of the data files supporting the imdb were missing
  *     2.) the directory passed to the constructor doesn't exist.
  *     3.) the directory and files all exist, but you don't have the permission to read them.
+ *     4.) either file is too short to be a data file, or couldn't be mapped into memory.
  */
 
   bool good() const;
 
+/**
+ * Method: advise
+ * --------------
+ * Tells the kernel how the data files are about to be read, so that an
+ * application can switch between phases: kRandomAccess for point queries
+ * (no readahead), and kSequentialAccess for passes over the whole
+ * database (aggressive readahead, and pages dropped once passed).
+ */
+
+  enum accessHint { kRandomAccess, kSequentialAccess };
+  void advise(accessHint hint) const;
+
 /**
  * Method: getCredits
  * ------------------
@@ -50,9 +117,141 @@ class imdb {
   
   bool getCredits(const std::string& player, std::vector<film>& films) const;
 
+/**
+ * Methods: getActorId
+ *          getFilmId
+ * ------------------
+ * Every actor and film record is identified by its byte offset into the
+ * actor or movie file.  These ids are stable for the lifetime of the data
+ * files, are always positive, and are strictly less than getActorIdBound()
+ * and getFilmIdBound() respectively, so they can index flat arrays and
+ * bitsets directly.
+ *
+ * @return the id of the specified actor/actress or film, or kNoRecord if
+ *         it isn't in the database.
+ */
+
+  static const int kNoRecord = -1;
+  int getActorId(const std::string& player) const;
+  int getFilmId(const film& movie) const;
+  size_t getActorIdBound() const { return actorInfo.fileSize; }
+  size_t getFilmIdBound() const { return movieInfo.fileSize; }
+
+/**
+ * Method: getActorOrdinals
+ * ------------------------
+ * Arrays indexed by actor id have an entry for every byte of the actor
+ * file.  Every actor also has an ordinal, its position in getAllActorIds,
+ * and ordinals run densely from 0 up to getAllActorIds().size(), so arrays
+ * indexed by them have just one entry per player.  The table returned maps
+ * ids to ordinals: it has getActorIdBound() entries, and entry id holds the
+ * ordinal of the actor with that id (entries that aren't ids hold
+ * kNoRecord).  It's built the first time it's asked for (safely, even with
+ * several threads querying at once) and reused from then on.
+ */
+
+  const std::vector<int>& getActorOrdinals() const;
+
+/**
+ * Methods: getActorName
+ *          getFilmData
+ * --------------------
+ * Materializes the actor/actress name or film stored at the specified id.
+ * No checking is done, so the id had better have come from this imdb.
+ */
+
   std::string getActorName(const int offset) const;
   film getFilmData(const int offset) const;
 
+/**
+ * Methods: getActorNameView
+ *          getFilmTitleView
+ *          getFilmYear
+ * ---------------------
+ * Zero-copy versions of getActorName and getFilmData.  The string_views
+ * point straight into the mapped files, so they're free to construct and
+ * remain valid for as long as the imdb does.
+ */
+
+  std::string_view getActorNameView(int actorId) const;
+  std::string_view getFilmTitleView(int filmId) const;
+  int getFilmYear(int filmId) const;
+
+/**
+ * Methods: getCreditIds
+ *          getCastIds
+ *          getAllActorIds
+ *          getAllFilmIds
+ * -----------------------
+ * Non-allocating ranges over the film ids making up an actor's credits,
+ * the actor ids making up a film's cast, and every actor or film id in
+ * the database (sorted by name, and by title then year, respectively).
+ */
+
+  idRange getCreditIds(int actorId) const;
+  idRange getCastIds(int filmId) const;
+  idRange getAllActorIds() const;
+  idRange getAllFilmIds() const;
+
+/**
+ * Methods: getActorIdsByPrefix
+ *          getActorIdsByFoldedPrefix
+ *          getActorIdsByFoldedName
+ * ----------------------------------
+ * Name lookups for when the exact name isn't known.  getActorIdsByPrefix
+ * returns the run of the actor table whose names start with prefix.  The
+ * folded variants ignore case (ASCII only): they return the run of ids
+ * whose names start with, or are equal to, the supplied text.  They use a
+ * second copy of the actor table sorted without regard to case.  That
+ * table is built the first time a folded lookup is made (safely, even
+ * with several threads querying at once) and reused from then on, or up
+ * front by calling buildFoldedIndex at startup.  Every returned range is
+ * ordered, so an empty range means no match.
+ */
+
+  void buildFoldedIndex() const { getFoldedActorIds(); }
+  idRange getActorIdsByPrefix(std::string_view prefix) const;
+  idRange getActorIdsByFoldedPrefix(std::string_view prefix) const;
+  idRange getActorIdsByFoldedName(std::string_view name) const;
+
+/**
+ * Methods: hasCostarIndex
+ *          getCostars
+ * ---------------------
+ * If the data directory also holds a co-star index built by build-costars
+ * (and it was built from these very actor and movie files), then
+ * getCostars hands back every other player the specified actor has
+ * appeared with, each paired with one film they share, as a single
+ * contiguous range.  Without the index, getCostars returns an empty range.
+ */
+
+  bool hasCostarIndex() const { return costarFile != NULL; }
+  costarRange getCostars(int actorId) const;
+
+/**
+ * Constant: kCostarFileName
+ * -------------------------
+ * The name of the co-star index file within the data directory.  The file
+ * is a header of four ints (actordata size, moviedata size, number of
+ * rows, number of edges), the actor id of each row in ascending order,
+ * one more than that many ints giving where each row's edges start, and
+ * then the edges themselves.
+ */
+
+  static const char *const kCostarFileName;
+
+/**
+ * Methods: getCredits
+ *          getCast
+ * ----------------
+ * Id-based variants of getCredits and getCast that hand back the ids
+ * of the credits or cast rather than building films and strings.  The
+ * supplied vector is cleared before it's populated.
+ */
+
+  void getCredits(int actorId, std::vector<int>& filmIds) const;
+  void getCast(int filmId, std::vector<int>& actorIds) const;
+
 /**
  * Method: getCast
  * ---------------
@@ -86,6 +285,7 @@ class imdb {
   static const char *const kMovieFileName;
   const void *actorFile;
   const void *movieFile;
+  const void *costarFile;
   
   // everything below here is complicated and needn't be touched.
   // you're free to investigate, but you're on your own.
@@ -93,10 +293,25 @@ class imdb {
     int fd;
     size_t fileSize;
     const void *fileMap;
-  } actorInfo, movieInfo;
+  } actorInfo, movieInfo, costarInfo;
   
-  static const void *acquireFileMap(const std::string& fileName, struct fileInfo& info);
+  static const int *getRecordIds(const void *file, int offset, int fixedBytes, short& count);
+  static const void *acquireFileMap(const std::string& fileName, struct fileInfo& info,
+                                    mapMode mode = kLazyMap);
   static void releaseFileMap(struct fileInfo& info);
+  void acquireCostarIndex(const std::string& fileName, mapMode mode);
+  bool costarIndexIsSound(const int *header, size_t fileSize) const;
+
+  mutable std::once_flag foldedActorIdsBuilt;
+  mutable std::vector<int> foldedActorIds;
+  const std::vector<int>& getFoldedActorIds() const;
+
+  mutable std::once_flag actorOrdinalsBuilt;
+  mutable std::vector<int> actorOrdinals;
+
+  std::thread prefaulter;
+  std::atomic<bool> stopPrefaulting;
+  void prefault();
 
   imdb(const imdb& original) = delete;
   imdb& operator=(const imdb& rhs) = delete;
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <iomanip> // for setw formatter
 #include <map>
@@ -143,9 +145,72 @@ static void listAllMoviesAndCostars(const imdb& db, const string& player) {
   listCostars(player, credits, db);
 }
 
+/**
+ * Function: timeLookups
+ * ---------------------
+ * Runs the supplied lookup once for every key and returns the
+ * number of lookups per second it managed.  The lookup returns the id it
+ * found, and the ids are summed into the sink so that none of the work
+ * can be optimized away.
+ */
+template <typename Key, typename Lookup>
+static double timeLookups(const vector<Key>& keys, Lookup lookup, long& sink) {
+  auto start = chrono::steady_clock::now();
+  for (const Key& key: keys) sink += lookup(key);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return keys.size() / elapsed.count();
+}
+
+/**
+ * Function: benchmarkLookups
+ * --------------------------
+ * Microbenchmark comparing name and film lookups the way imdb used to do
+ * them (materializing a std::string or film for every lower_bound probe)
+ * against the string_view-based getActorId and getFilmId.  The keys are
+ * sampled evenly across the entire database.
+ */
+static void benchmarkLookups(const imdb& db) {
+  const size_t kNumSamples = 20000;
+  idRange actorIds = db.getAllActorIds();
+  idRange filmIds = db.getAllFilmIds();
+  vector<string> players;
+  vector<film> movies;
+  for (size_t i = 0; i < kNumSamples; i++) {
+    players.push_back(db.getActorName(actorIds[i * actorIds.size() / kNumSamples]));
+    movies.push_back(db.getFilmData(filmIds[i * filmIds.size() / kNumSamples]));
+  }
+
+  long sink = 0;
+  double actorsBefore = timeLookups(players, [&](const string& player) {
+    return *lower_bound(actorIds.begin(), actorIds.end(), player, [&](int offset, const string& b) {
+      return db.getActorName(offset) < b;
+    });
+  }, sink);
+  double actorsAfter = timeLookups(players, [&](const string& player) {
+    return db.getActorId(player);
+  }, sink);
+  double filmsBefore = timeLookups(movies, [&](const film& movie) {
+    return *lower_bound(filmIds.begin(), filmIds.end(), movie, [&](int offset, const film& b) {
+      return db.getFilmData(offset) < b;
+    });
+  }, sink);
+  double filmsAfter = timeLookups(movies, [&](const film& movie) {
+    return db.getFilmId(movie);
+  }, sink);
+
+  cout << fixed << setprecision(0);
+  cout << "  actor lookups: " << setw(10) << actorsBefore << "/sec allocating, "
+       << setw(10) << actorsAfter << "/sec zero-copy" << endl;
+  cout << "  film lookups:  " << setw(10) << filmsBefore << "/sec allocating, "
+       << setw(10) << filmsAfter << "/sec zero-copy" << endl;
+  if (sink == 0) cout << "  (no lookups were performed)" << endl;
+}
+
 int main(int argc, const char *argv[]) {
+  bool benchmark = argc == 2 && string(argv[1]) == "-b";
   if (argc != 2) {
     cerr << "Usage: " << argv[0] << " <actor>" << endl;
+    cerr << "       " << argv[0] << " -b" << endl;
     return kWrongArgumentCount;
   }
 
@@ -155,6 +220,11 @@ int main(int argc, const char *argv[]) {
     return kDatabaseNotFound;
   }
 
+  if (benchmark) {
+    benchmarkLookups(db);
+    return 0;
+  }
+
   string player = argv[1];
   listAllMoviesAndCostars(db, player);
   return 0;
@@ -11,17 +11,25 @@ using namespace std;
  * each entry in the vector is one leg in the path from an actor to
  * another.
  */
-path::path(const string& player) : startPlayer(player) {} 
+path::path(const imdb& db, int startPlayer) : db(&db), startPlayer(startPlayer) {} 
 // ommission of links from init list calls the default constructor
 
+/**
+ * clear() keeps the vector's capacity, which is the whole point.
+ */
+void path::reset(int player) {
+  startPlayer = player;
+  links.clear();
+}
+
 /**
  * Simply tack on a new connection pair to the end of the links vector.
  * It ain't our business to be checking for consistency of connection, as
  * that's the resposibility of the surrounding class to decide (or at
  * least we're making it their business.
  */
-void path::addConnection(const film& movie, const string& player) {
-  links.push_back(connection(movie, player));
+void path::addConnection(int movie, int player) {
+  links.push_back(connection { movie, player });
 } 
 
 /**
@@ -37,32 +45,35 @@ void path::undoConnection() {
  * Returns the last player (actor/actress) currently 
  * in the path.
  */
-const string& path::getLastPlayer() const {
+int path::getLastPlayer() const {
   if (links.size() == 0) return startPlayer;
   return links.back().player;
 }
 
+/**
+ * Each movie stays where it is, since reversing a chain of alternating
+ * players and movies keeps the movies in reverse order, and every player
+ * shifts over by one.
+ */
 void path::reverse() {
-  // construct the reverse
-  path reverseOfPath(getLastPlayer());
-  for (int i = links.size() - 1; i > 0; i--)
-    reverseOfPath.addConnection(links[i].movie, links[i-1].player);
-  if (links.size() > 0)
-    reverseOfPath.addConnection(links[0].movie, startPlayer);
-
-  // then assign self to its reverse
-  *this = reverseOfPath;
+  int lastPlayer = getLastPlayer();
+  for (int i = (int) links.size() - 1; i > 0; i--)
+    links[i].player = links[i - 1].player;
+  if (links.size() > 0) links[0].player = startPlayer;
+  startPlayer = lastPlayer;
+  for (size_t i = 0, j = links.size(); i + 1 < j; i++, j--)
+    swap(links[i], links[j - 1]);
 }
 
 ostream& operator<<(ostream& os, const path& p) {
   if (p.links.size() == 0) return os << string("[Empty path]") << endl;
   
-  os << p.startPlayer << " was in ";
-  for (int i = 0; i < (int) p.links.size(); i++) {
-    os << "\"" << p.links[i].movie.title << "\" (" << p.links[i].movie.year << ") with " 
-       << p.links[i].player << "." << endl;
-    if (i + 1 == (int) p.links.size()) break;
-    os << p.links[i].player << " was in ";
+  int player = p.startPlayer;
+  for (const path::connection& link: p.links) {
+    os << p.db->getActorNameView(player) << " was in \"" << p.db->getFilmTitleView(link.movie)
+       << "\" (" << 1900 + p.db->getFilmYear(link.movie) << ") with "
+       << p.db->getActorNameView(link.player) << "." << endl;
+    player = link.player;
   }
   
   return os;
@@ -1,5 +1,5 @@
 #pragma once
-#include "imdb-utils.h"
+#include "imdb.h"
 #include <string>
 #include <vector>
 #include <iostream>
@@ -14,6 +14,13 @@
  * of the consistency checks one might want.  You're
  * free to change this code to include those consistency
  * checks, or you may leave it alone and use it as is.
+ *
+ * Players and movies are stored as their imdb record ids rather than
+ * as strings and films, so building, copying and reversing a path never
+ * allocates anything beyond the links vector itself.  Names are looked
+ * up in the imdb only when the path is published with operator<<.  A
+ * path can be reset and reused, and it keeps its storage when it is, so
+ * one path per thread serves any number of queries without allocating.
  */
 
 class path {
@@ -31,6 +38,9 @@ class path {
  * all that often--typically, it's granted only to functions 
  * that are being implemented on behalf of the class.  operator<<
  * is one of those rare functions.
+ *
+ * Each link is published on its own line, in the same format search
+ * has always used, with the year of each movie given in full.
  */
   friend std::ostream& operator<<(std::ostream& os, const path& p);
   
@@ -42,8 +52,20 @@ class path {
    * and no one else.  The path grows because the client
    * appends movie/actor pairs, and the path shrinks when
    * the client calls undoConnection.
+   *
+   * @param db the imdb the ids in the path come from.
+   * @param startPlayer the id of the first player, or imdb::kNoRecord
+   *                    if the path is to be reset before use.
    */
-  path(const std::string& startPlayer);
+  path(const imdb& db, int startPlayer = imdb::kNoRecord);
+
+  /**
+   * Method: reset
+   * -------------
+   * Empties the path so that it holds just the specified player,
+   * holding on to its storage so that it can be reused.
+   */
+  void reset(int startPlayer);
 
   /**
    * Method: getLength
@@ -67,16 +89,12 @@ class path {
    * player prior to the addConnection message was also in the
    * movie.  In theory, there is no limit to the number of 
    * of movie-player connections that can be added.
-   * 
-   * The implementation makes a deep copy of the specified movie and
-   * actor, so you needn't worry about the memory management issues that
-   * come up here.
    *
-   * @param movie a reference to the film record starring both the specified
+   * @param movie the id of the film starring both the specified
    *              player and the last player in the path.
-   * @param player a reference to the actor/actress appearing in the specified film.
+   * @param player the id of the actor/actress appearing in the specified film.
    */ 
-  void addConnection(const film& movie, const std::string& player);
+  void addConnection(int movie, int player);
 
   /**
    * Method: undoConnection
@@ -90,18 +108,15 @@ class path {
   /**
    * Method: getLastPlayer
    * ---------------------
-   * Returns the address of the last player in the
+   * Returns the id of the last player in the
    * path.  Self-explanatory.
-   *
-   * @return the address of a string storing the name of the
-   *         last player.
    */  
-  const std::string& getLastPlayer() const;
+  int getLastPlayer() const;
 
   /**
    * Method: reverse
    * ---------------
-   * Reverses the receiving path.
+   * Reverses the receiving path, in place.
    */
   void reverse();
   
@@ -111,14 +126,11 @@ class path {
   // so its very definition should be private, right?
 
   struct connection {
-    film movie;
-    std::string player;
-    
-    // convenience struct with constructors.. 
-    connection() {}
-    connection(const film& movie, const std::string& player) : movie(movie), player(player) {}
+    int movie;
+    int player;
   };
   
-  std::string startPlayer;
+  const imdb *db;
+  int startPlayer;
   std::vector<connection> links;
 };
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip> // for setw formatter
+#include <string>
+#include <thread>
+#include "imdb.h"
+#include "six-degrees.h"
+using namespace std;
+
+static const int kWrongArgumentCount = 1;
+static const int kDatabaseNotFound = 2;
+
+typedef bool (*searchFn)(const imdb&, const string&, const string&, path&, searchStats *);
+
+/**
+ * Function: parallelBidirectionalSearch
+ * -------------------------------------
+ * parallelSearch with one thread per core, shaped like the other searches.
+ */
+static bool parallelBidirectionalSearch(const imdb& db, const string& source, const string& dest,
+                                        path& p, searchStats *stats) {
+  return parallelSearch(db, source, dest, p, max(1u, thread::hardware_concurrency()), stats);
+}
+
+/**
+ * Function: sequentialBidirectionalSearch
+ * ---------------------------------------
+ * bidirectionalSearch without an arena, shaped like the other searches.
+ */
+static bool sequentialBidirectionalSearch(const imdb& db, const string& source, const string& dest,
+                                          path& p, searchStats *stats) {
+  return bidirectionalSearch(db, source, dest, p, stats);
+}
+
+/**
+ * Function: runOne
+ * ----------------
+ * Times one search strategy on one pair and prints a line summarizing
+ * the path length it found, how much it expanded, and how long it took.
+ */
+static void runOne(const imdb& db, const string& name, searchFn search,
+                   const string& source, const string& dest) {
+  path p(db);
+  searchStats stats;
+  auto start = chrono::steady_clock::now();
+  bool found = search(db, source, dest, p, &stats);
+  chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+  cout << "  " << setw(14) << left << name << right
+       << " length " << (found ? to_string(p.getLength()) : string("-"))
+       << ", " << setw(9) << stats.actorsSeen << " actors seen"
+       << ", " << setw(7) << stats.filmsExpanded << " films expanded"
+       << ", " << fixed << setprecision(2) << setw(10) << elapsed.count() << " ms"
+       << ", frontiers [";
+  for (size_t i = 0; i < stats.frontierSizes.size(); i++)
+    cout << (i == 0 ? "" : " ") << stats.frontierSizes[i];
+  cout << "]" << endl;
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc < 3 || argc % 2 == 0) {
+    cerr << "Usage: " << argv[0] << " <actor1> <actor2> [<actor1> <actor2> ...]" << endl;
+    return kWrongArgumentCount;
+  }
+
+  imdb db(kIMDBDataDirectory);
+  if (!db.good()) {
+    cerr << "Data directory not found!  Aborting..." << endl;
+    return kDatabaseNotFound;
+  }
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    cout << argv[i] << " -> " << argv[i + 1] << endl;
+    runOne(db, "unidirectional", unidirectionalSearch, argv[i], argv[i + 1]);
+    runOne(db, "bidirectional", sequentialBidirectionalSearch, argv[i], argv[i + 1]);
+    runOne(db, "parallel", parallelBidirectionalSearch, argv[i], argv[i + 1]);
+  }
+  return 0;
+}
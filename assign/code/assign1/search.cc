@@ -1,91 +1,263 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <list>
-#include <unordered_map>
-#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 #include "imdb.h"
+#include "six-degrees.h"
+#include "thread-pool.h"
 
 using namespace std;
 
 static const int kWrongArgumentCount = 1;
 static const int kDatabaseNotFound = 2;
+static const int kQueryFileNotFound = 3;
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <actor1> <actor2>" << endl;
-        return kWrongArgumentCount;
+/**
+ * Function: answerQuery
+ * ---------------------
+ * Searches for a path between source and dest and publishes either
+ * the path or the polite no-connection message to the supplied stream.
+ * With more than one search thread, each level of the search is itself
+ * expanded in parallel.  Otherwise the search reuses the supplied arena,
+ * if there is one.
+ */
+static void answerQuery(const imdb& db, const string& source, const string& dest, ostream& os,
+                        size_t searchThreads = 1, searchArena *arena = nullptr) {
+    path p(db);
+    bool found = searchThreads > 1 ? parallelSearch(db, source, dest, p, searchThreads)
+                                   : bidirectionalSearch(db, source, dest, p, nullptr, arena);
+    if (!found) {
+        os << "No connection found between "
+           << source << " and " << dest << "." << endl;
+        return;
     }
+    os << p;
+}
 
-    imdb db(kIMDBDataDirectory);
-    if (!db.good()) {
-        cerr << "Data directory not found!  Aborting..." << endl;
-        return kDatabaseNotFound;
+/**
+ * Function: resolveName
+ * ---------------------
+ * Maps a name that may be miscapitalized or cut short onto a name that's
+ * actually in the database.  An exact match wins, then a unique match
+ * ignoring case, then a unique name starting with the supplied text
+ * (ignoring case).  Anything else is explained on the supplied stream,
+ * with a few suggestions if the name is ambiguous.
+ *
+ * @return true if and only if resolved was set to a name in the database.
+ */
+static bool resolveName(const imdb& db, const string& name, string& resolved, ostream& os) {
+    const size_t kMaxSuggestions = 5;
+    if (db.getActorId(name) != imdb::kNoRecord) {
+        resolved = name;
+        return true;
+    }
+
+    idRange matches = db.getActorIdsByFoldedName(name);
+    if (matches.empty()) matches = db.getActorIdsByFoldedPrefix(name);
+    if (matches.size() == 1) {
+        resolved = db.getActorName(matches[0]);
+        os << "(Taking \"" << name << "\" to mean " << resolved << ".)" << endl;
+        return true;
     }
 
-    string source(argv[1]), dest(argv[2]);
-    list<pair<string, short>> queue;
-    unordered_map<string, pair<film, string>> ancestor;
-    set<string> seenActors;
-    set<film> seenFilms;
-
-    queue.push_back({source, 0});
-    bool found = false;
-
-    while (!queue.empty()) {
-        pair<string, short> frontPair = queue.front();
-        const string& front = frontPair.first;
-        const short chainLength = frontPair.second;
-
-        if (chainLength >= 6) break;
-
-        queue.pop_front();
-        seenActors.insert(front);
-
-        vector<film> films;
-        db.getCredits(front, films);
-
-        for (const film& f: films) {
-            if (seenFilms.find(f) != seenFilms.end()) continue;
-            seenFilms.insert(f);
-            vector<string> cast;
-            db.getCast(f, cast);
-            for (const string& p: cast) {
-                if (seenActors.find(p) != seenActors.end()) continue;
-                seenActors.insert(p);
-                ancestor[p] = {f, front};
-                queue.push_back({p, chainLength + 1});
-                if (p == dest) {
-                    found = true;
-                    break;
+    if (matches.empty()) {
+        os << name << " doesn't appear to be in our database." << endl;
+        return false;
+    }
+    os << name << " is ambiguous; " << matches.size() << " players match, including:" << endl;
+    for (size_t i = 0; i < matches.size() && i < kMaxSuggestions; i++)
+        os << "    " << db.getActorNameView(matches[i]) << endl;
+    return false;
+}
+
+/**
+ * Convenience Struct: query
+ * -------------------------
+ * One line of a batch: the pair being asked about, plus the answer and
+ * how long it took once some worker thread gets around to it.
+ */
+struct query {
+    string source;
+    string dest;
+    string answer;
+    double latency;   // in milliseconds
+    double finished;  // in milliseconds since the imdb started opening
+};
+
+/**
+ * Function: readQueries
+ * ---------------------
+ * Reads one query per line, with the two names separated by a tab.
+ * Blank lines are ignored, and lines without a tab are reported and
+ * skipped.
+ */
+static void readQueries(istream& is, vector<query>& queries) {
+    string line;
+    for (int lineNumber = 1; getline(is, line); lineNumber++) {
+        if (line.empty()) continue;
+        size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            cerr << "Ignoring line " << lineNumber << ": expected <actor1><tab><actor2>." << endl;
+            continue;
+        }
+        queries.push_back(query { line.substr(0, tab), line.substr(tab + 1), "", 0, 0 });
+    }
+}
+
+/**
+ * Function: runBatch
+ * ------------------
+ * Answers every query against the one shared (and therefore warm) imdb,
+ * spreading them across a pool of worker threads.  Names that aren't
+ * quite right are resolved through resolveName first.  The answers are
+ * published in the order the queries were read, each prefixed by the
+ * query and its latency, followed by a summary of the whole batch.
+ * opened is when the imdb started opening and ready is when it finished,
+ * so the summary can also say how long it took before the first answer.
+ */
+typedef chrono::steady_clock::time_point timePoint;
+static void runBatch(const imdb& db, vector<query>& queries, size_t numThreads,
+                     timePoint opened, timePoint ready) {
+    auto start = chrono::steady_clock::now();
+    {
+        ThreadPool pool(numThreads);
+        for (query& q: queries) {
+            pool.schedule([&db, &q, opened] {
+                auto queryStart = chrono::steady_clock::now();
+                ostringstream answer;
+                string source, dest;
+                if (resolveName(db, q.source, source, answer) &&
+                    resolveName(db, q.dest, dest, answer)) {
+                    // each worker thread keeps one arena for all the queries it answers
+                    thread_local searchArena arena;
+                    answerQuery(db, source, dest, answer, 1, &arena);
                 }
+                auto queryEnd = chrono::steady_clock::now();
+                q.answer = answer.str();
+                q.latency = chrono::duration<double, milli>(queryEnd - queryStart).count();
+                q.finished = chrono::duration<double, milli>(queryEnd - opened).count();
+            });
+        }
+        pool.wait();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    cout << fixed << setprecision(2);
+    vector<double> latencies;
+    double firstAnswer = 0;
+    for (size_t i = 0; i < queries.size(); i++) {
+        const query& q = queries[i];
+        cout << "[" << i + 1 << "] " << q.source << " -> " << q.dest
+             << " (" << q.latency << " ms)" << endl << q.answer << endl;
+        latencies.push_back(q.latency);
+        if (i == 0 || q.finished < firstAnswer) firstAnswer = q.finished;
+    }
+    if (latencies.empty()) return;
+
+    sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double latency: latencies) total += latency;
+    cout << queries.size() << " queries answered in " << elapsed.count() << " s using "
+         << numThreads << " threads (" << queries.size() / elapsed.count() << " queries/sec)." << endl;
+    cout << "Latency (ms): mean " << total / latencies.size()
+         << ", median " << latencies[latencies.size() / 2]
+         << ", p95 " << latencies[latencies.size() * 95 / 100]
+         << ", max " << latencies.back() << endl;
+    cout << "Time to first query (ms): " << firstAnswer << " (imdb open took "
+         << chrono::duration<double, milli>(ready - opened).count() << ")" << endl;
+}
+
+/**
+ * Function: parseMapMode
+ * ----------------------
+ * Translates the argument to -m into an imdb::mapMode, returning false
+ * if it isn't one of the names printUsage lists.
+ */
+static bool parseMapMode(const string& name, imdb::mapMode& mode) {
+    static const pair<const char *, imdb::mapMode> kModes[] = {
+        { "lazy", imdb::kLazyMap }, { "advise", imdb::kAdviseMap },
+        { "populate", imdb::kPopulateMap }, { "prefault", imdb::kPrefaultMap }
+    };
+    for (const auto& m: kModes) {
+        if (name == m.first) {
+            mode = m.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void printUsage(const char *progname) {
+    cerr << "Usage: " << progname << " [-p <threads>] <actor1> <actor2>" << endl;
+    cerr << "       " << progname << " -b [-j <threads>] [-m <map-mode>] [<query-file>]" << endl;
+    cerr << "In batch mode (-b), queries are read one per line as <actor1><tab><actor2>," << endl;
+    cerr << "from the query file if one is named and from standard input otherwise." << endl;
+    cerr << "<map-mode> is lazy (the default), advise, populate or prefault." << endl;
+    cerr << "With -p, a single query is itself searched using that many threads." << endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool batch = argc >= 2 && string(argv[1]) == "-b";
+    size_t numThreads = max(1u, thread::hardware_concurrency());
+    size_t searchThreads = 1;
+    imdb::mapMode mode = imdb::kLazyMap;
+    const char *queryFileName = NULL;
+    if (batch) {
+        int i = 2;
+        for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+            string flag = argv[i];
+            if (flag == "-j" && atoi(argv[i + 1]) > 0) {
+                numThreads = atoi(argv[i + 1]);
+            } else if (flag != "-m" || !parseMapMode(argv[i + 1], mode)) {
+                printUsage(argv[0]);
+                return kWrongArgumentCount;
             }
-            if (found) break;
         }
-        if (found) break;
+        if (i < argc) queryFileName = argv[i++];
+        if (i != argc) {
+            printUsage(argv[0]);
+            return kWrongArgumentCount;
+        }
+    } else if (argc == 5 && string(argv[1]) == "-p" && atoi(argv[2]) > 0) {
+        searchThreads = atoi(argv[2]);
+        argv += 2;
+    } else if (argc != 3) {
+        printUsage(argv[0]);
+        return kWrongArgumentCount;
     }
 
-    if (!found) {
-        cout << "No connection found between "
-             << source << " and " << dest << "." << endl;
-        return 0;
+    vector<query> queries;
+    if (batch && queryFileName == NULL) {
+        readQueries(cin, queries);
+    } else if (batch) {
+        ifstream queryFile(queryFileName);
+        if (!queryFile) {
+            cerr << "Query file \"" << queryFileName << "\" not found!  Aborting..." << endl;
+            return kQueryFileNotFound;
+        }
+        readQueries(queryFile, queries);
     }
 
-    list<pair<film, string>> path;
-    string currentActor = dest;
-    while (currentActor != source) {
-        path.push_front({ancestor[currentActor].first, currentActor});
-        currentActor = ancestor[currentActor].second;
+    timePoint opened = chrono::steady_clock::now();
+    imdb db(kIMDBDataDirectory, mode);
+    if (!db.good()) {
+        cerr << "Data directory not found!  Aborting..." << endl;
+        return kDatabaseNotFound;
     }
+    if (batch) db.buildFoldedIndex();
+    timePoint ready = chrono::steady_clock::now();
 
-    currentActor = source;
-    for (const pair<film, string>& p: path) {
-        cout << currentActor
-             << " was in \"" << p.first.title << "\" ("
-             << 1900 + p.first.year
-             << ") with " << p.second
-             << "." << endl;
-        currentActor = p.second;
+    if (!batch) {
+        answerQuery(db, argv[1], argv[2], cout, searchThreads);
+        return 0;
     }
 
+    runBatch(db, queries, numThreads, opened, ready);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <unordered_map>
+#include <set>
+#include <thread>
+#include <vector>
+#include "atomic-bitset.h"
+#include "six-degrees.h"
+
+using namespace std;
+
+bool unidirectionalSearch(const imdb& db, const string& source, const string& dest,
+                          path& p, searchStats *stats) {
+    list<pair<string, short>> queue;
+    unordered_map<string, pair<film, string>> ancestor;
+    set<string> seenActors;
+    set<film> seenFilms;
+
+    queue.push_back({source, 0});
+    bool found = false;
+    short lastLength = -1;
+
+    while (!queue.empty()) {
+        pair<string, short> frontPair = queue.front();
+        const string& front = frontPair.first;
+        const short chainLength = frontPair.second;
+
+        if (chainLength >= kMaxDegrees) break;
+        if (stats != nullptr && chainLength != lastLength) {
+            // everything queued right now belongs to this level
+            stats->frontierSizes.push_back(queue.size());
+            lastLength = chainLength;
+        }
+
+        queue.pop_front();
+        seenActors.insert(front);
+
+        vector<film> films;
+        db.getCredits(front, films);
+
+        for (const film& f: films) {
+            if (seenFilms.find(f) != seenFilms.end()) continue;
+            seenFilms.insert(f);
+            vector<string> cast;
+            db.getCast(f, cast);
+            for (const string& p: cast) {
+                if (seenActors.find(p) != seenActors.end()) continue;
+                seenActors.insert(p);
+                ancestor[p] = {f, front};
+                queue.push_back({p, chainLength + 1});
+                if (p == dest) {
+                    found = true;
+                    break;
+                }
+            }
+            if (found) break;
+        }
+        if (found) break;
+    }
+
+    if (stats != nullptr) {
+        stats->actorsSeen = seenActors.size();
+        stats->filmsExpanded = seenFilms.size();
+    }
+    if (!found) return false;
+
+    // the chain is recovered from dest back to source, so it's built backwards
+    p.reset(db.getActorId(dest));
+    string currentActor = dest;
+    while (currentActor != source) {
+        const pair<film, string>& link = ancestor[currentActor];
+        p.addConnection(db.getFilmId(link.first), db.getActorId(link.second));
+        currentActor = link.second;
+    }
+    p.reverse();
+    return true;
+}
+
+/**
+ * One player reached by a search, along with the film through which they
+ * were reached and the player they were reached from.
+ */
+struct discovery {
+    int actor;
+    int film;
+    int parent;
+};
+
+/**
+ * One half of a bidirectional search, keyed entirely by imdb record id.
+ * seenActors and seenFilms are bitsets indexed by id, filmsSeen lists the
+ * bits set in seenFilms, and levels[d] lists the players first reached
+ * after d films.  reachedBy holds how each player was reached, so that the
+ * path can be recovered a hop at a time.  It's indexed by actor ordinal
+ * (see imdb::getActorOrdinals) rather than id, which would take an entry
+ * per byte of the actor file, and an entry means something only while the
+ * player's seenActors bit is set.
+ * Only the first numLevels levels are in use; the storage of every vector,
+ * levels included, is kept from one search to the next, and reset clears
+ * exactly the bits the last search set.
+ */
+struct searchSide {
+    vector<bool> seenActors;
+    vector<bool> seenFilms;
+    vector<int> filmsSeen;
+    const int *ordinals = nullptr;
+    vector<discovery> reachedBy;
+    vector<vector<discovery>> levels;
+    size_t numLevels = 0;
+
+    void reset(const imdb& db, int root) {
+        ordinals = db.getActorOrdinals().data();
+        if (seenActors.size() != db.getActorIdBound() || seenFilms.size() != db.getFilmIdBound()) {
+            seenActors.assign(db.getActorIdBound(), false);
+            seenFilms.assign(db.getFilmIdBound(), false);
+            reachedBy.resize(db.getAllActorIds().size());
+        } else {
+            for (size_t d = 0; d < numLevels; d++)
+                for (const discovery& reached: levels[d]) seenActors[reached.actor] = false;
+            for (int f: filmsSeen) seenFilms[f] = false;
+        }
+        filmsSeen.clear();
+        numLevels = 0;
+        reachedBy[ordinals[root]] = discovery { root, imdb::kNoRecord, imdb::kNoRecord };
+        addLevel().push_back(reachedBy[ordinals[root]]);
+        seenActors[root] = true;
+    }
+
+    vector<discovery>& addLevel() {
+        if (numLevels == levels.size()) levels.emplace_back();
+        levels[numLevels].clear();
+        return levels[numLevels++];
+    }
+
+    const vector<discovery>& frontier() const { return levels[numLevels - 1]; }
+    short depth() const { return numLevels - 1; }
+    size_t actorsSeen() const {
+        size_t count = 0;
+        for (size_t d = 0; d < numLevels; d++) count += levels[d].size();
+        return count;
+    }
+
+    const discovery& find(int actor) const { return reachedBy[ordinals[actor]]; }
+};
+
+searchArena::searchArena() : sides { unique_ptr<searchSide>(new searchSide),
+                                     unique_ptr<searchSide>(new searchSide) } {}
+searchArena::~searchArena() {}
+
+/**
+ * Marks p as reached from front through film f, and reports whether the
+ * far side had already reached it.  Players reached for the first time
+ * are added to next.
+ */
+static bool reach(searchSide& near, const searchSide& far, int p, int f, int front,
+                  vector<discovery>& next) {
+    if (near.seenActors[p]) return false;
+    near.seenActors[p] = true;
+    discovery& reached = near.reachedBy[near.ordinals[p]];
+    reached = discovery { p, f, front };
+    next.push_back(reached);
+    return far.seenActors[p];
+}
+
+/**
+ * Expands every player in the frontier of the near side by one film, and
+ * returns the first newly reached player that the far side has already
+ * reached, or kNoRecord if the two sides still haven't met.  When the imdb
+ * has a co-star index, each player's neighbors are a single contiguous
+ * run of edges, and films never need to be visited at all.
+ */
+static int expandLevel(const imdb& db, searchSide& near, const searchSide& far) {
+    vector<discovery>& next = near.addLevel();
+    const vector<discovery>& frontier = near.levels[near.numLevels - 2];
+    for (const discovery& reached: frontier) {
+        int front = reached.actor;
+        if (db.hasCostarIndex()) {
+            for (const costar& c: db.getCostars(front)) {
+                if (reach(near, far, c.actorId, c.filmId, front, next)) return c.actorId;
+            }
+            continue;
+        }
+
+        for (int f: db.getCreditIds(front)) {
+            if (near.seenFilms[f]) continue;
+            near.seenFilms[f] = true;
+            near.filmsSeen.push_back(f);
+            for (int p: db.getCastIds(f)) {
+                if (reach(near, far, p, f, front, next)) return p;
+            }
+        }
+    }
+    return imdb::kNoRecord;
+}
+
+bool bidirectionalSearch(const imdb& db, const string& source, const string& dest,
+                         path& p, searchStats *stats, searchArena *arena) {
+    int sourceId = db.getActorId(source), destId = db.getActorId(dest);
+    if (sourceId == imdb::kNoRecord || destId == imdb::kNoRecord || sourceId == destId)
+        return false;
+
+    unique_ptr<searchArena> ownArena;
+    if (arena == nullptr) {
+        ownArena.reset(new searchArena);
+        arena = ownArena.get();
+    }
+    searchSide& forward = arena->forward();
+    searchSide& backward = arena->backward();
+    forward.reset(db, sourceId);
+    backward.reset(db, destId);
+
+    int meeting = imdb::kNoRecord;
+    while (meeting == imdb::kNoRecord && forward.depth() + backward.depth() < kMaxDegrees &&
+           !forward.frontier().empty() && !backward.frontier().empty()) {
+        // always grow whichever side promises to be cheaper
+        bool growForward = forward.frontier().size() <= backward.frontier().size();
+        searchSide& near = growForward ? forward : backward;
+        searchSide& far = growForward ? backward : forward;
+        if (stats != nullptr) stats->frontierSizes.push_back(near.frontier().size());
+        meeting = expandLevel(db, near, far);
+    }
+
+    if (stats != nullptr) {
+        stats->actorsSeen = forward.actorsSeen() + backward.actorsSeen();
+        stats->filmsExpanded = forward.filmsSeen.size() + backward.filmsSeen.size();
+    }
+    if (meeting == imdb::kNoRecord) return false;
+
+    // walk back to the source, turn that around, and then walk on to dest
+    p.reset(meeting);
+    for (int currentActor = meeting; currentActor != sourceId;) {
+        const discovery& reached = forward.find(currentActor);
+        p.addConnection(reached.film, reached.parent);
+        currentActor = reached.parent;
+    }
+    p.reverse();
+    for (int currentActor = meeting; currentActor != destId;) {
+        const discovery& reached = backward.find(currentActor);
+        p.addConnection(reached.film, reached.parent);
+        currentActor = reached.parent;
+    }
+    return true;
+}
+
+/**
+ * One half of a parallel search.  Rather than an ancestor map, which the
+ * threads would have to share, every level the side has expanded keeps the
+ * links that discovered it, and reachedBy holds the same link indexed by
+ * actor ordinal, as searchSide's does, so the path is recovered at the end a
+ * hop at a time.  Only the thread that wins a player's seenActors bit
+ * writes its entry, and entries for players never reached are left
+ * uninitialized, so the array costs only the pages the search touches.
+ */
+struct parallelSide {
+    atomicBitset seenActors;
+    atomicBitset seenFilms;
+    const int *ordinals;
+    unique_ptr<discovery[]> reachedBy;
+    vector<vector<discovery>> levels;
+
+    parallelSide(const imdb& db, int root) :
+        seenActors(db.getActorIdBound()), seenFilms(db.getFilmIdBound()),
+        ordinals(db.getActorOrdinals().data()),
+        reachedBy(new discovery[db.getAllActorIds().size()]) {
+        seenActors.testAndSet(root);
+        reachedBy[ordinals[root]] = discovery { root, imdb::kNoRecord, imdb::kNoRecord };
+        levels.push_back({ reachedBy[ordinals[root]] });
+    }
+
+    const vector<discovery>& frontier() const { return levels.back(); }
+    short depth() const { return levels.size() - 1; }
+
+    const discovery& find(int actor) const { return reachedBy[ordinals[actor]]; }
+};
+
+static const size_t kFrontierChunkSize = 64;
+
+/**
+ * Expands the near side's frontier by one level using up to numThreads
+ * threads, which pull chunks of the frontier off a shared atomic counter
+ * so that a few prolific players don't leave the other threads idle.
+ * Returns the first newly reached player the far side had already
+ * reached, or kNoRecord if there wasn't one.  far may be null, in which
+ * case the level is always expanded in full.
+ */
+static int parallelExpandLevel(const imdb& db, parallelSide& near, const atomicBitset *far,
+                               size_t numThreads, size_t& filmsExpanded) {
+    const vector<discovery>& frontier = near.frontier();
+    size_t numChunks = (frontier.size() + kFrontierChunkSize - 1) / kFrontierChunkSize;
+    size_t numWorkers = max<size_t>(1, min(numThreads, numChunks));
+    vector<vector<discovery>> discovered(numWorkers);
+    atomic<size_t> nextChunk(0);
+    atomic<size_t> films(0);
+    atomic<int> meeting(imdb::kNoRecord);
+
+    vector<thread> workers;
+    for (size_t w = 0; w < numWorkers; w++) {
+        workers.push_back(thread([&](vector<discovery>& found) {
+            // claims p for this side, and reports whether that closed the gap
+            auto reach = [&](int p, int f, int front) {
+                if (!near.seenActors.testAndSet(p)) return false;
+                discovery& reached = near.reachedBy[near.ordinals[p]];
+                reached = discovery { p, f, front };
+                found.push_back(reached);
+                if (far == nullptr || !far->test(p)) return false;
+                int none = imdb::kNoRecord;
+                meeting.compare_exchange_strong(none, p);
+                return true;
+            };
+
+            size_t localFilms = 0;
+            while (meeting.load(memory_order_relaxed) == imdb::kNoRecord) {
+                size_t start = nextChunk.fetch_add(kFrontierChunkSize);
+                if (start >= frontier.size()) break;
+                size_t end = min(start + kFrontierChunkSize, frontier.size());
+                bool met = false;
+                for (size_t i = start; i < end && !met; i++) {
+                    int front = frontier[i].actor;
+                    if (db.hasCostarIndex()) {
+                        for (const costar& c: db.getCostars(front))
+                            if ((met = reach(c.actorId, c.filmId, front))) break;
+                        continue;
+                    }
+                    for (int f: db.getCreditIds(front)) {
+                        if (!near.seenFilms.testAndSet(f)) continue;
+                        localFilms++;
+                        for (int p: db.getCastIds(f))
+                            if ((met = reach(p, f, front))) break;
+                        if (met) break;
+                    }
+                }
+            }
+            films += localFilms;
+        }, ref(discovered[w])));
+    }
+    for (thread& worker: workers) worker.join();
+
+    // each thread's discoveries are simply laid end to end
+    size_t total = 0;
+    for (const vector<discovery>& found: discovered) total += found.size();
+    vector<discovery> next;
+    next.reserve(total);
+    for (const vector<discovery>& found: discovered) next.insert(next.end(), found.begin(), found.end());
+    near.levels.push_back(move(next));
+    filmsExpanded += films;
+    return meeting;
+}
+
+bool parallelSearch(const imdb& db, const string& source, const string& dest,
+                    path& p, size_t numThreads, searchStats *stats) {
+    int sourceId = db.getActorId(source), destId = db.getActorId(dest);
+    if (sourceId == imdb::kNoRecord || destId == imdb::kNoRecord || sourceId == destId)
+        return false;
+
+    parallelSide forward(db, sourceId), backward(db, destId);
+    size_t filmsExpanded = 0;
+    int meeting = imdb::kNoRecord;
+    while (meeting == imdb::kNoRecord && forward.depth() + backward.depth() < kMaxDegrees &&
+           !forward.frontier().empty() && !backward.frontier().empty()) {
+        bool growForward = forward.frontier().size() <= backward.frontier().size();
+        parallelSide& near = growForward ? forward : backward;
+        parallelSide& far = growForward ? backward : forward;
+        if (stats != nullptr) stats->frontierSizes.push_back(near.frontier().size());
+        meeting = parallelExpandLevel(db, near, &far.seenActors, numThreads, filmsExpanded);
+    }
+
+    if (stats != nullptr) {
+        stats->actorsSeen = 0;
+        for (const parallelSide *side: { &forward, &backward })
+            for (const vector<discovery>& level: side->levels) stats->actorsSeen += level.size();
+        stats->filmsExpanded = filmsExpanded;
+    }
+    if (meeting == imdb::kNoRecord) return false;
+
+    p.reset(meeting);
+    for (int currentActor = meeting; currentActor != sourceId;) {
+        const discovery& d = forward.find(currentActor);
+        p.addConnection(d.film, d.parent);
+        currentActor = d.parent;
+    }
+    p.reverse();
+    for (int currentActor = meeting; currentActor != destId;) {
+        const discovery& d = backward.find(currentActor);
+        p.addConnection(d.film, d.parent);
+        currentActor = d.parent;
+    }
+    return true;
+}
+
+bool singleSourceLevels(const imdb& db, const string& source,
+                        vector<vector<int>>& levels, size_t numThreads) {
+    int sourceId = db.getActorId(source);
+    if (sourceId == imdb::kNoRecord) return false;
+
+    parallelSide side(db, sourceId);
+    size_t filmsExpanded = 0;
+    while (!side.frontier().empty())
+        parallelExpandLevel(db, side, nullptr, numThreads, filmsExpanded);
+    side.levels.pop_back();  // the last level expanded to nothing
+
+    levels.clear();
+    for (const vector<discovery>& level: side.levels) {
+        levels.push_back(vector<int>());
+        levels.back().reserve(level.size());
+        for (const discovery& d: level) levels.back().push_back(d.actor);
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "imdb.h"
+#include "path.h"
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Constant: kMaxDegrees
+ * ---------------------
+ * The longest chain of films either search is willing to report.  Anything
+ * further apart than this is reported as having no connection.
+ */
+const short kMaxDegrees = 6;
+
+/**
+ * Convenience Class: searchArena
+ * ------------------------------
+ * Scratch storage for bidirectionalSearch: the visited bitsets and the
+ * per-level lists of players each side reaches.  A search handed an
+ * arena clears only what the previous search touched and reuses all of
+ * the storage, so a thread that answers many queries with one arena stops
+ * allocating after its first few.  An arena may only be used by one
+ * search at a time.
+ */
+struct searchSide;
+class searchArena {
+ public:
+  searchArena();
+  ~searchArena();
+  searchSide& forward() { return *sides[0]; }
+  searchSide& backward() { return *sides[1]; }
+
+ private:
+  std::unique_ptr<searchSide> sides[2];
+  searchArena(const searchArena& original) = delete;
+  searchArena& operator=(const searchArena& rhs) = delete;
+};
+
+/**
+ * Convenience Struct: searchStats
+ * -------------------------------
+ * Bookkeeping either search can optionally fill in so that the two
+ * strategies can be compared.  frontierSizes records the size of every
+ * frontier at the moment it was expanded, in the order expanded.
+ */
+struct searchStats {
+  std::vector<size_t> frontierSizes;
+  size_t actorsSeen = 0;
+  size_t filmsExpanded = 0;
+};
+
+/**
+ * Function: unidirectionalSearch
+ * ------------------------------
+ * Breadth-first search outward from source only, one player at a time,
+ * until dest is discovered or kMaxDegrees hops have been explored.
+ *
+ * @param db the imdb being queried.
+ * @param source the player the path should start with.
+ * @param dest the player the path should end with.
+ * @param p populated with the shortest path from source to dest, if there
+ *          is one.  It should have been constructed from the same db.
+ * @param stats if non-null, populated with frontier sizes and visit counts.
+ * @return true if and only if a path of at most kMaxDegrees films was found.
+ */
+bool unidirectionalSearch(const imdb& db, const std::string& source, const std::string& dest,
+                          path& p, searchStats *stats = nullptr);
+
+/**
+ * Function: bidirectionalSearch
+ * -----------------------------
+ * Breadth-first search from both source and dest at once.  Each step
+ * expands one full level of whichever frontier is smaller, and the search
+ * stops as soon as the two sides meet.  The path reported is a shortest
+ * one, just as with unidirectionalSearch, though not necessarily the same one.
+ *
+ * Parameters and return value are as for unidirectionalSearch, plus an
+ * optional arena to reuse.  Without one, the search allocates its own.
+ */
+bool bidirectionalSearch(const imdb& db, const std::string& source, const std::string& dest,
+                         path& p, searchStats *stats = nullptr, searchArena *arena = nullptr);
+
+/**
+ * Function: parallelSearch
+ * ------------------------
+ * The same bidirectional search as bidirectionalSearch, except that each
+ * level is expanded by up to numThreads threads at once.  The frontier is
+ * handed out to the threads in small chunks, visited players and films
+ * are marked in atomic bitsets, and each thread collects the players it
+ * discovers on its own, so the next frontier is assembled without a lock.
+ *
+ * Parameters and return value are as for unidirectionalSearch.
+ */
+bool parallelSearch(const imdb& db, const std::string& source, const std::string& dest,
+                    path& p, size_t numThreads, searchStats *stats = nullptr);
+
+/**
+ * Function: singleSourceLevels
+ * ----------------------------
+ * Breadth-first search outward from source with no depth limit, using
+ * the same parallel level expansion as parallelSearch.  On return,
+ * levels[d] holds the ids of every player exactly d films away from
+ * source, so levels[0] holds just source itself.
+ *
+ * @return true if and only if source is in the database.
+ */
+bool singleSourceLevels(const imdb& db, const std::string& source,
+                        std::vector<std::vector<int>>& levels, size_t numThreads);
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/**
+ * Runs diskimageaccess over one or more disk images (ones made by gen-image,
+ * say) in each of a number of scenarios, and reports how much each run read,
+ * in read system calls and sectors as its -s counters count them, and how
+ * long it took, in wall clock and CPU time.  Each scenario is run a few times
+ * and the fastest run is the one reported, so that the page cache is warm.
+ */
+
+#define MAX_ARGS 16
+#define MAX_OUTPUT (64 * 1024)
+
+struct scenario {
+  const char *name;
+  const char *args;     // diskimageaccess flags, separated by spaces
+};
+
+static const struct scenario kScenarios[] = {
+  { "-i",            "-qi" },
+  { "-i no cache",   "-qi -c 0" },
+  { "-i mapped",     "-qim" },
+  { "-i -j 4",       "-qi -j 4" },
+  { "-i -a 16",      "-qi -a 16" },
+  { "-p",            "-qp" },
+  { "-p no cache",   "-qp -c 0" },
+  { "-p -j 4",       "-qp -j 4" },
+};
+
+static char kDefaultProgram[] = "./diskimageaccess";
+
+struct result {
+  int failed;
+  double wallMs;
+  double userMs;
+  double sysMs;
+  unsigned long readCalls;
+  unsigned long sectorsRead;
+  unsigned long mappedSectors;
+};
+
+/**
+ * Finds the counter called name in diskimageaccess's -s report.  Returns 0
+ * if it isn't there.
+ */
+static unsigned long GetCounter(const char *report, const char *name) {
+  const char *line = strstr(report, name);
+  unsigned long value = 0;
+  if (line != NULL) sscanf(line + strlen(name), "%lu", &value);
+  return value;
+}
+
+/**
+ * Runs diskimageaccess once, with its standard output thrown away and its
+ * standard error (where -s reports) captured.
+ */
+static struct result RunOnce(char *program, const struct scenario *s, char *diskpath) {
+  struct result r;
+  memset(&r, 0, sizeof(r));
+  char args[strlen(s->args) + sizeof(" -s")];
+  sprintf(args, "%s -s", s->args);
+  char *argv[MAX_ARGS + 3];
+  int argc = 0;
+  argv[argc++] = program;
+  for (char *arg = strtok(args, " "); arg != NULL && argc < MAX_ARGS + 1; arg = strtok(NULL, " ")) {
+    argv[argc++] = arg;
+  }
+  argv[argc++] = diskpath;
+  argv[argc] = NULL;
+
+  int fds[2];
+  if (pipe(fds) < 0) {
+    r.failed = 1;
+    return r;
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execv(program, argv);
+    _exit(127);
+  }
+  close(fds[1]);
+
+  // Read everything, so that diskimageaccess never blocks writing, but
+  // keep only as much as fits.
+  static char report[MAX_OUTPUT + 1];
+  char chunk[4096];
+  size_t length = 0;
+  ssize_t n;
+  while ((n = read(fds[0], chunk, sizeof(chunk))) > 0) {
+    size_t keep = (size_t) n < MAX_OUTPUT - length ? (size_t) n : MAX_OUTPUT - length;
+    memcpy(report + length, chunk, keep);
+    length += keep;
+  }
+  report[length] = '\0';
+  close(fds[0]);
+
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    r.failed = 1;
+    return r;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  r.wallMs = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  r.userMs = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3;
+  r.sysMs = usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+  r.readCalls = GetCounter(report, "diskimg read calls");
+  r.sectorsRead = GetCounter(report, "diskimg sectors read");
+  r.mappedSectors = GetCounter(report, "diskimg mapped sectors");
+  return r;
+}
+
+static void BenchImage(char *program, char *diskpath, int numRuns) {
+  printf("%s:\n", diskpath);
+  printf("  %-14s %10s %10s %10s %12s %14s %14s\n", "scenario", "wall ms", "user ms", "sys ms",
+         "read calls", "sectors read", "mapped sectors");
+  for (size_t i = 0; i < sizeof(kScenarios) / sizeof(kScenarios[0]); i++) {
+    const struct scenario *s = &kScenarios[i];
+    struct result best;
+    for (int run = 0; run < numRuns; run++) {
+      struct result r = RunOnce(program, s, diskpath);
+      if (run == 0 || r.failed || r.wallMs < best.wallMs) best = r;
+      if (r.failed) break;
+    }
+    if (best.failed) {
+      printf("  %-14s failed\n", s->name);
+      continue;
+    }
+    printf("  %-14s %10.2f %10.2f %10.2f %12lu %14lu %14lu\n", s->name, best.wallMs, best.userMs,
+           best.sysMs, best.readCalls, best.sectorsRead, best.mappedSectors);
+  }
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s [-x <program>] [-n <runs>] diskimagePath...\n", progname);
+  fprintf(stderr, "-x <p> the diskimageaccess to run (default ./diskimageaccess)\n");
+  fprintf(stderr, "-n <n> runs of each scenario, keeping the fastest (default 3)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  char *program = kDefaultProgram;
+  int numRuns = 3;
+  int opt;
+  while ((opt = getopt(argc, argv, "x:n:")) != -1) {
+    switch (opt) {
+    case 'x':
+      program = optarg;
+      break;
+    case 'n':
+      numRuns = atoi(optarg);
+      if (numRuns < 1) PrintUsageAndExit(argv[0]);
+      break;
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind == argc) PrintUsageAndExit(argv[0]);
+
+  for (int i = optind; i < argc; i++) BenchImage(program, argv[i], numRuns);
+  return 0;
+}
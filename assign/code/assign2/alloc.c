@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "diskimg.h"
+#include "inode.h"
+
+#define FREE_PER_SUPERBLOCK 100   // entries in s_free and s_inode
+#define INODES_PER_SECTOR (DISKIMG_SECTOR_SIZE / sizeof(struct inode))
+
+/**
+ * What a block in the free list chain holds, apart from zeros.
+ */
+struct freechain {
+  uint16_t nfree;
+  uint16_t free[FREE_PER_SUPERBLOCK];
+};
+
+static int baddatablock(struct unixfilesystem *fs, int block) {
+  return block < INODE_START_SECTOR + fs->superblock.s_isize || block >= fs->superblock.s_fsize;
+}
+
+/**
+ * Takes one block off the free list.  Returns its number, or -1 if there
+ * are none left (or the list is damaged).
+ */
+static int allocblock(struct unixfilesystem *fs) {
+  struct filsys *sb = &fs->superblock;
+  if (sb->s_nfree == 0 || sb->s_nfree > FREE_PER_SUPERBLOCK) return -1;
+  int block = sb->s_free[sb->s_nfree - 1];
+  if (block == 0) {
+    fprintf(stderr, "No space left on device.\n");
+    return -1;
+  }
+  if (baddatablock(fs, block)) {
+    fprintf(stderr, "Bad block %d on the free list.\n", block);
+    return -1;
+  }
+  sb->s_nfree--;
+  if (sb->s_nfree == 0) {
+    // block is the next link in the chain, so the next 100 come from it
+    struct freechain chain;
+    char buf[DISKIMG_SECTOR_SIZE];
+    if (diskimg_readsector(fs->dfd, block, buf) != DISKIMG_SECTOR_SIZE) {
+      sb->s_nfree++;
+      return -1;
+    }
+    memcpy(&chain, buf, sizeof(chain));
+    if (chain.nfree > FREE_PER_SUPERBLOCK) {
+      fprintf(stderr, "Bad free list block %d.\n", block);
+      sb->s_nfree++;
+      return -1;
+    }
+    sb->s_nfree = chain.nfree;
+    memcpy(sb->s_free, chain.free, sizeof(sb->s_free));
+  }
+  fs->superblockDirty = 1;
+  return block;
+}
+
+static int freeblock(struct unixfilesystem *fs, int block) {
+  struct filsys *sb = &fs->superblock;
+  if (baddatablock(fs, block)) return -1;
+  if (sb->s_nfree == 0) {
+    sb->s_nfree = 1;
+    sb->s_free[0] = 0;
+  }
+  if (sb->s_nfree >= FREE_PER_SUPERBLOCK) {
+    // start a new link in the chain with what the superblock has now
+    char buf[DISKIMG_SECTOR_SIZE];
+    struct freechain chain;
+    chain.nfree = sb->s_nfree;
+    memcpy(chain.free, sb->s_free, sizeof(chain.free));
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, &chain, sizeof(chain));
+    if (diskimg_writesector(fs->dfd, block, buf) != DISKIMG_SECTOR_SIZE) return -1;
+    sb->s_nfree = 0;
+  }
+  sb->s_free[sb->s_nfree++] = block;
+  fs->superblockDirty = 1;
+  return 0;
+}
+
+int alloc_blocks(struct unixfilesystem *fs, int numBlocks, int *blocks) {
+  for (int i = 0; i < numBlocks; i++) {
+    if ((blocks[i] = allocblock(fs)) < 0) {
+      (void) alloc_freeblocks(fs, blocks, i);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int alloc_freeblocks(struct unixfilesystem *fs, const int *blocks, int numBlocks) {
+  int err = 0;
+  // in reverse, so that allocating them again hands them out in order
+  for (int i = numBlocks - 1; i >= 0; i--) {
+    if (freeblock(fs, blocks[i]) < 0) err = -1;
+  }
+  return err;
+}
+
+int alloc_inode(struct unixfilesystem *fs) {
+  struct filsys *sb = &fs->superblock;
+  if (sb->s_ninode > FREE_PER_SUPERBLOCK) sb->s_ninode = 0;
+  int numInodes = sb->s_isize * INODES_PER_SECTOR;
+  for (int refilled = 0; refilled < 2; refilled++) {
+    while (sb->s_ninode > 0) {
+      int inumber = sb->s_inode[--sb->s_ninode];
+      fs->superblockDirty = 1;
+      struct inode in;
+      // what's remembered may have been allocated since, or be nonsense
+      if (inumber >= 1 && inumber <= numInodes && inode_iget(fs, inumber, &in) == 0 &&
+          !(in.i_mode & IALLOC)) {
+        return inumber;
+      }
+    }
+    if (refilled) break;
+
+    // Nothing remembered, so look through the whole inode table for more.
+    for (int inumber = 1; inumber <= numInodes && sb->s_ninode < FREE_PER_SUPERBLOCK; inumber++) {
+      struct inode in;
+      if (inode_iget(fs, inumber, &in) < 0) return -1;
+      if (!(in.i_mode & IALLOC)) sb->s_inode[sb->s_ninode++] = inumber;
+    }
+  }
+  fprintf(stderr, "Out of inodes.\n");
+  return -1;
+}
+
+void alloc_freeinode(struct unixfilesystem *fs, int inumber) {
+  struct filsys *sb = &fs->superblock;
+  if (sb->s_ninode >= FREE_PER_SUPERBLOCK) return;
+  sb->s_inode[sb->s_ninode++] = inumber;
+  fs->superblockDirty = 1;
+}
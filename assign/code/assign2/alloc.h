@@ -0,0 +1,45 @@
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+#include "unixfilesystem.h"
+
+/**
+ * Block and inode allocation, done the way Unix v6 did it (in alloc.c).
+ * Free blocks are kept on a chained list: the superblock holds up to 100 of
+ * them in s_free, and the last one it hands out, s_free[0], holds the next
+ * 100 (preceded by their count), and so on, until a 0 ends the chain.  Free
+ * inodes are remembered in s_inode, which is refilled by scanning the inode
+ * table whenever it runs dry.
+ *
+ * The superblock is changed in memory and only written by
+ * unixfilesystem_flush.  None of this may be used by more than one thread at
+ * a time, nor while other threads are reading the filesystem.
+ */
+
+/**
+ * Takes numBlocks blocks off the free list, putting their numbers in
+ * blocks.  Their contents are whatever they were.  Returns 0 on success, or
+ * -1 (with nothing taken) if there aren't that many free blocks.
+ */
+int alloc_blocks(struct unixfilesystem *fs, int numBlocks, int *blocks);
+
+/**
+ * Puts numBlocks blocks back on the free list.  Returns 0 on success, or -1
+ * on error.
+ */
+int alloc_freeblocks(struct unixfilesystem *fs, const int *blocks, int numBlocks);
+
+/**
+ * Finds an unallocated inode.  It's still unallocated when it's returned;
+ * it's up to the caller to fill it in and write it.  Returns its inumber, or
+ * -1 if every inode is in use.
+ */
+int alloc_inode(struct unixfilesystem *fs);
+
+/**
+ * Remembers that the specified inode is free again, if there's room to.
+ * The caller clears the inode itself.
+ */
+void alloc_freeinode(struct unixfilesystem *fs, int inumber);
+
+#endif // _ALLOC_H_
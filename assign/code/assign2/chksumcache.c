@@ -0,0 +1,154 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "chksumcache.h"
+#include "chksumfile.h"
+#include "diskimg.h"
+
+#define CHKSUMCACHE_MAGIC 0x6b633676    // "v6ck"
+#define CHKSUMCACHE_VERSION 3
+#define INODES_PER_SECTOR (DISKIMG_SECTOR_SIZE / sizeof(struct inode))
+
+/**
+ * What's at the start of the file, and identifies the image it's for.
+ */
+struct cacheheader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t imageDevice;
+  uint64_t imageInode;
+  uint32_t isize;
+  uint32_t fsize;
+  uint32_t numEntries;
+};
+
+/**
+ * One remembered checksum.  An entry is only used while the inode's mtime,
+ * size and block addresses match; valid is 0 for inodes that have never been
+ * stored.  The addresses, kept as a hash, catch an image that's been
+ * replaced wholesale by another whose files happen to share mtimes and sizes.
+ */
+struct cacheentry {
+  uint32_t inumber;
+  uint32_t mtime;
+  uint32_t size;
+  uint32_t addrHash;
+  uint8_t valid;
+  uint8_t chksum[CHKSUMFILE_SIZE];
+};
+
+struct chksumcache {
+  char *path;
+  struct cacheheader header;
+  struct cacheentry *entries;   // indexed by inumber - 1
+  int modified;
+};
+
+static uint32_t inode_mtime(const struct inode *in) {
+  return ((uint32_t) in->i_mtime[0] << 16) | in->i_mtime[1];
+}
+
+static uint32_t inode_size(const struct inode *in) {
+  return ((uint32_t) in->i_size0 << 16) | in->i_size1;
+}
+
+static uint32_t inode_addrhash(const struct inode *in) {
+  // FNV-1a over i_addr
+  uint32_t hash = 2166136261u;
+  const uint8_t *bytes = (const uint8_t *) in->i_addr;
+  for (size_t i = 0; i < sizeof(in->i_addr); i++) hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+/**
+ * Reads the cache's file into the (empty) cache, if it's for the same
+ * image.  Anything the least bit off is ignored, and the cache starts over.
+ */
+static void loadcache(struct chksumcache *cc) {
+  FILE *f = fopen(cc->path, "rb");
+  if (f == NULL) return;
+  struct cacheheader header;
+  if (fread(&header, sizeof(header), 1, f) == 1 && memcmp(&header, &cc->header, sizeof(header)) == 0) {
+    size_t numRead = fread(cc->entries, sizeof(struct cacheentry), header.numEntries, f);
+    if (numRead != header.numEntries) memset(cc->entries, 0, header.numEntries * sizeof(struct cacheentry));
+  }
+  fclose(f);
+}
+
+struct chksumcache *chksumcache_open(struct unixfilesystem *fs, const char *path) {
+  struct stat st;
+  if (fstat(fs->dfd, &st) < 0) return NULL;
+
+  struct chksumcache *cc = calloc(1, sizeof(struct chksumcache));
+  if (cc == NULL) return NULL;
+  memset(&cc->header, 0, sizeof(cc->header));   // the padding is compared too
+  cc->header.magic = CHKSUMCACHE_MAGIC;
+  cc->header.version = CHKSUMCACHE_VERSION;
+  cc->header.imageDevice = st.st_dev;
+  cc->header.imageInode = st.st_ino;
+  cc->header.isize = fs->superblock.s_isize;
+  cc->header.fsize = fs->superblock.s_fsize;
+  cc->header.numEntries = fs->superblock.s_isize * INODES_PER_SECTOR;
+  cc->path = strdup(path);
+  cc->entries = calloc(cc->header.numEntries > 0 ? cc->header.numEntries : 1, sizeof(struct cacheentry));
+  if (cc->path == NULL || cc->entries == NULL) {
+    chksumcache_close(cc);
+    return NULL;
+  }
+  loadcache(cc);
+  return cc;
+}
+
+int chksumcache_lookup(struct chksumcache *cc, int inumber, const struct inode *in, void *chksum) {
+  if (inumber < 1 || (uint32_t) inumber > cc->header.numEntries) return 0;
+  const struct cacheentry *e = &cc->entries[inumber - 1];
+  if (!e->valid || e->inumber != (uint32_t) inumber ||
+      e->mtime != inode_mtime(in) || e->size != inode_size(in) || e->addrHash != inode_addrhash(in)) {
+    return 0;
+  }
+  memcpy(chksum, e->chksum, CHKSUMFILE_SIZE);
+  return 1;
+}
+
+void chksumcache_store(struct chksumcache *cc, int inumber, const struct inode *in, const void *chksum) {
+  if (inumber < 1 || (uint32_t) inumber > cc->header.numEntries) return;
+  // i_mtime only has whole seconds, so a file changed during this second
+  // could change again without its i_mtime moving; don't trust it yet.
+  if (inode_mtime(in) >= (uint32_t) time(NULL)) return;
+  struct cacheentry *e = &cc->entries[inumber - 1];
+  e->inumber = inumber;
+  e->mtime = inode_mtime(in);
+  e->size = inode_size(in);
+  e->addrHash = inode_addrhash(in);
+  memcpy(e->chksum, chksum, CHKSUMFILE_SIZE);
+  e->valid = 1;
+  __atomic_store_n(&cc->modified, 1, __ATOMIC_RELAXED);
+}
+
+int chksumcache_save(struct chksumcache *cc) {
+  if (!cc->modified) return 0;
+  char temp[strlen(cc->path) + 8];
+  sprintf(temp, "%s.new", cc->path);
+  FILE *f = fopen(temp, "wb");
+  if (f == NULL) return -1;
+  int ok = fwrite(&cc->header, sizeof(cc->header), 1, f) == 1 &&
+           fwrite(cc->entries, sizeof(struct cacheentry), cc->header.numEntries, f) == cc->header.numEntries;
+  if (fclose(f) != 0) ok = 0;
+  if (!ok || rename(temp, cc->path) < 0) {
+    remove(temp);
+    return -1;
+  }
+  cc->modified = 0;
+  return 0;
+}
+
+void chksumcache_close(struct chksumcache *cc) {
+  free(cc->path);
+  free(cc->entries);
+  free(cc);
+}
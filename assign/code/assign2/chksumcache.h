@@ -0,0 +1,55 @@
+#ifndef _CHKSUMCACHE_H_
+#define _CHKSUMCACHE_H_
+
+#include "unixfilesystem.h"
+
+/**
+ * A digest cache kept in a sidecar file next to an image, so that checksumming
+ * the same image over and over only has to hash what's changed since.  Each
+ * allocated inode's checksum is remembered along with the inode's i_mtime,
+ * size and block addresses, and is only handed back while all of them are
+ * what they were, so after a write only the inodes it changed are hashed
+ * again.  Inodes changed in the very second they're hashed aren't remembered,
+ * since i_mtime can't tell a second change that second from the first.  The
+ * file also records which image it belongs to (the image file's
+ * device and inode number, and the filesystem's geometry), and is ignored if
+ * used with any other.
+ *
+ * Lookups and stores for different inumbers may be made from different
+ * threads at once.
+ */
+struct chksumcache;
+
+/**
+ * Opens the cache kept in the file at path for the filesystem, loading what
+ * it holds if it exists and belongs to this image, and starting out empty
+ * otherwise.  Returns NULL on error.
+ */
+struct chksumcache *chksumcache_open(struct unixfilesystem *fs, const char *path);
+
+/**
+ * Looks for the checksum of inumber, whose inode is in, copying it into
+ * chksum (CHKSUMFILE_SIZE bytes) if it's known.  Returns 1 if it was, and 0
+ * otherwise.
+ */
+int chksumcache_lookup(struct chksumcache *cc, int inumber, const struct inode *in, void *chksum);
+
+/**
+ * Remembers the checksum of inumber, whose inode is in, unless in's i_mtime
+ * is this second or later.
+ */
+void chksumcache_store(struct chksumcache *cc, int inumber, const struct inode *in, const void *chksum);
+
+/**
+ * Writes the cache back to its file, if anything has been stored since it
+ * was opened.  The file is replaced all at once, so a run that's interrupted
+ * never leaves half a cache behind.  Returns 0 on success, or -1 on error.
+ */
+int chksumcache_save(struct chksumcache *cc);
+
+/**
+ * Releases the cache, without saving it.
+ */
+void chksumcache_close(struct chksumcache *cc);
+
+#endif // _CHKSUMCACHE_H_
@@ -11,51 +11,265 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "fsstats.h"
+#include "diskbatch.h"
+#include "sha1mb.h"
 #include <openssl/sha.h>
 
-int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
+// How much of a file is read at a time while checksumming it.
+#define CHKSUMFILE_CHUNK (64 * DISKIMG_SECTOR_SIZE)
+
+// Files up to this size are gathered whole by chksumfile_byinumbers and
+// hashed together with multi-buffer SHA-1; bigger ones are hashed as they're
+// read, which keeps memory down.
+#define CHKSUMFILE_GATHER_MAX (32 * DISKIMG_SECTOR_SIZE)
+
+static int byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
   SHA_CTX shactx;
   if (!SHA1_Init(&shactx)) {
     // An error occurred initializing the SHA1 context.
     return -1;
   }
 
-  struct inode in;
-  int err = inode_iget(fs, inumber, &in);
-  if (err < 0) {
-    return err;
+  struct file *f = file_open(fs, inumber);
+  if (f == NULL) {
+    return -1;
   }
 
-  if (!(in.i_mode & IALLOC)) {
+  if (!(f->in.i_mode & IALLOC)) {
     // The inode isn't allocated, so we can't hash it.
+    file_close(f);
     return -1;
   }
 
-  int size = inode_getsize(&in);
-  for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-    char buf[DISKIMG_SECTOR_SIZE];
-    int bno = offset/DISKIMG_SECTOR_SIZE;
-
-    int bytesMoved = file_getblock(fs, inumber, bno, buf);
-    if (bytesMoved < 0)
-      return -1;
-
-    if (!SHA1_Update(&shactx, buf, bytesMoved))
+  for (int offset = 0; offset < f->size; offset += CHKSUMFILE_CHUNK) {
+    char buf[CHKSUMFILE_CHUNK];
+    int bytesMoved = file_read(f, offset, buf, CHKSUMFILE_CHUNK);
+    if (bytesMoved <= 0 || !SHA1_Update(&shactx, buf, bytesMoved)) {
+      file_close(f);
       return -1;
+    }
   }
+  file_close(f);
 
   if (!SHA1_Final(chksum, &shactx))
     return -1;
   return SHA_DIGEST_LENGTH;
 }
 
-int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname, void *chksum) {
-  int inumber = pathname_lookup(fs, pathname);
-  if (inumber < 0) {
-    return inumber;
+int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
+  struct fsstats_span span = fsstats_begin();
+  int length = byinumber(fs, inumber, chksum);
+  fsstats_end(FSSTATS_CHKSUM_INUMBER, span);
+  return length;
+}
+
+int chksumfile_bydata(const void *data, int size, void *chksum) {
+  SHA_CTX shactx;
+  if (!SHA1_Init(&shactx) || !SHA1_Update(&shactx, data, size) || !SHA1_Final(chksum, &shactx))
+    return -1;
+  return SHA_DIGEST_LENGTH;
+}
+
+/**
+ * A run of one file's blocks that sit next to each other on disk, read with
+ * a single read into buf.
+ */
+struct extent {
+  int file;         // index into the inumbers being checksummed
+  int firstBlock;
+  int numBlocks;
+  char *buf;
+  int done;
+  int result;       // bytes read, or -1
+};
+
+struct pendingfile {
+  struct file *f;
+  SHA_CTX shactx;
+  char *data;       // the whole file, for a file gathered to hash with the others
+  int failed;
+};
+
+/**
+ * Queues the next extent of the files being checksummed, if there is one,
+ * as extent e.  *file and *block say where the last extent left off.
+ * Returns 1 if an extent was queued and 0 if there's nothing left.
+ */
+static int queueextent(struct diskbatch *b, struct pendingfile *files, int numFiles,
+                       int *file, int *block, struct extent *e) {
+  while (*file < numFiles) {
+    struct pendingfile *pf = &files[*file];
+    if (pf->failed || *block >= pf->f->numBlocks) {
+      (*file)++;
+      *block = 0;
+      continue;
+    }
+
+    const int *blocks = pf->f->blocks;
+    int n = 1;
+    while (n < CHKSUMFILE_CHUNK / DISKIMG_SECTOR_SIZE && *block + n < pf->f->numBlocks &&
+           blocks[*block + n] == blocks[*block + n - 1] + 1) {
+      n++;
+    }
+    e->file = *file;
+    e->firstBlock = *block;
+    e->numBlocks = n;
+    e->done = 0;
+    *block += n;
+    if (diskbatch_read(b, blocks[e->firstBlock], n, e->buf, e) < 0) {
+      pf->failed = 1;
+      continue;
+    }
+    return 1;
   }
+  return 0;
+}
 
-  return chksumfile_byinumber(fs, inumber, chksum);
+/**
+ * Reads the files one at a time with file_read, for when there are no reads
+ * to overlap: gathered files into their data, and the rest straight into
+ * their hashes, as byinumber does.
+ */
+static void readfiles(struct pendingfile *files, int numFiles) {
+  for (int i = 0; i < numFiles; i++) {
+    struct pendingfile *pf = &files[i];
+    for (int offset = 0; !pf->failed && offset < pf->f->size; offset += CHKSUMFILE_CHUNK) {
+      char buf[CHKSUMFILE_CHUNK];
+      char *dest = pf->data != NULL ? pf->data + offset : buf;
+      int bytesMoved = file_read(pf->f, offset, dest, CHKSUMFILE_CHUNK);
+      if (bytesMoved <= 0 || (pf->data == NULL && !SHA1_Update(&pf->shactx, buf, bytesMoved))) {
+        pf->failed = 1;
+      }
+    }
+  }
+}
+
+/**
+ * Reads the files through the batch, keeping it as full of extents as it
+ * will go.  The batch is left empty, whatever happens.  Returns 0 on
+ * success, or -1 if the reads couldn't be set up or failed outright.
+ */
+static int readbatched(struct diskbatch *b, struct pendingfile *files, int numFiles) {
+  int depth = diskbatch_depth(b);
+  struct extent *extents = calloc(depth, sizeof(struct extent));
+  struct diskbatch_completion *done = malloc(depth * sizeof(struct diskbatch_completion));
+  char *buffers = malloc((size_t) depth * CHKSUMFILE_CHUNK);
+  if (extents == NULL || done == NULL || buffers == NULL) {
+    free(extents);
+    free(done);
+    free(buffers);
+    return -1;
+  }
+  for (int e = 0; e < depth; e++) extents[e].buf = buffers + (size_t) e * CHKSUMFILE_CHUNK;
+
+  // The extents in flight occupy a ring, oldest first, and are hashed in
+  // that order as they complete, however out of order that happens.
+  int nextFile = 0, nextBlock = 0;
+  int oldest = 0, inFlight = 0;
+  int err = 0;
+  while (!err) {
+    while (inFlight < depth &&
+           queueextent(b, files, numFiles, &nextFile, &nextBlock, &extents[(oldest + inFlight) % depth])) {
+      inFlight++;
+    }
+    if (inFlight == 0) break;
+
+    int numDone = diskbatch_wait(b, 1, done, depth);
+    if (numDone < 0) {
+      err = 1;
+      break;
+    }
+    for (int i = 0; i < numDone; i++) {
+      struct extent *e = done[i].tag;
+      e->done = 1;
+      e->result = done[i].result;
+    }
+
+    while (inFlight > 0 && extents[oldest].done) {
+      struct extent *e = &extents[oldest];
+      struct pendingfile *pf = &files[e->file];
+      int bytes = pf->f->size - e->firstBlock * DISKIMG_SECTOR_SIZE;
+      if (bytes > e->numBlocks * DISKIMG_SECTOR_SIZE) bytes = e->numBlocks * DISKIMG_SECTOR_SIZE;
+      if (!pf->failed && e->result < bytes) {
+        pf->failed = 1;
+      } else if (!pf->failed && pf->data != NULL) {
+        memcpy(pf->data + e->firstBlock * DISKIMG_SECTOR_SIZE, e->buf, bytes);
+      } else if (!pf->failed && !SHA1_Update(&pf->shactx, e->buf, bytes)) {
+        pf->failed = 1;
+      }
+      oldest = (oldest + 1) % depth;
+      inFlight--;
+    }
+  }
+  if (err) diskbatch_drain(b);
+  free(extents);
+  free(done);
+  free(buffers);
+  return err ? -1 : 0;
+}
+
+int chksumfile_byinumbers(struct unixfilesystem *fs, const int *inumbers, int numFiles,
+                          void *chksums, int *lengths, struct diskbatch *b) {
+  struct pendingfile *files = calloc(numFiles, sizeof(struct pendingfile));
+  if (files == NULL) return -1;
+
+  for (int i = 0; i < numFiles; i++) {
+    struct pendingfile *pf = &files[i];
+    pf->f = file_open(fs, inumbers[i]);
+    pf->failed = pf->f == NULL || !(pf->f->in.i_mode & IALLOC);
+    if (pf->failed) continue;
+    if (pf->f->size <= CHKSUMFILE_GATHER_MAX) {
+      pf->failed = (pf->data = malloc(pf->f->size + 1)) == NULL;
+    } else {
+      pf->failed = !SHA1_Init(&pf->shactx);
+    }
+  }
+
+  int err = 0;
+  if (b != NULL) {
+    err = readbatched(b, files, numFiles) < 0;
+  } else {
+    readfiles(files, numFiles);
+  }
+
+  // Hash the gathered files all together.
+  struct sha1mb_message *messages = malloc(numFiles * sizeof(struct sha1mb_message));
+  int numMessages = 0;
+  for (int i = 0; messages != NULL && !err && i < numFiles; i++) {
+    struct pendingfile *pf = &files[i];
+    if (pf->failed || pf->data == NULL) continue;
+    messages[numMessages].data = pf->data;
+    messages[numMessages].length = pf->f->size;
+    messages[numMessages].digest = (unsigned char *) chksums + i * CHKSUMFILE_SIZE;
+    numMessages++;
+  }
+  if (messages != NULL) sha1mb_digest(messages, numMessages);
+
+  for (int i = 0; i < numFiles; i++) {
+    struct pendingfile *pf = &files[i];
+    char *chksum = (char *) chksums + i * CHKSUMFILE_SIZE;
+    if (err || pf->failed || (pf->data != NULL && messages == NULL)) {
+      lengths[i] = -1;
+    } else if (pf->data != NULL) {
+      lengths[i] = SHA_DIGEST_LENGTH;
+    } else {
+      lengths[i] = SHA1_Final((unsigned char *) chksum, &pf->shactx) ? SHA_DIGEST_LENGTH : -1;
+    }
+    if (pf->f != NULL) file_close(pf->f);
+    free(pf->data);
+  }
+  free(messages);
+  free(files);
+  return err ? -1 : 0;
+}
+
+int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname, void *chksum) {
+  struct fsstats_span span = fsstats_begin();
+  int inumber = pathname_lookup(fs, pathname);
+  int length = inumber < 0 ? inumber : chksumfile_byinumber(fs, inumber, chksum);
+  fsstats_end(FSSTATS_CHKSUM_PATHNAME, span);
+  return length;
 }
 
 void chksumfile_cvt2string(void *chksum, char *outstring) {
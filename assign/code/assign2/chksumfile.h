@@ -2,6 +2,7 @@
 #define _CHKSUMFILE_H_
 
 #include "unixfilesystem.h"
+#include "diskbatch.h"
 
 #define CHKSUMFILE_SIZE 20   
 #define CHKSUMFILE_STRINGSIZE ((2*CHKSUMFILE_SIZE)+1)
@@ -13,6 +14,31 @@
  */
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum);
 
+/**
+ * Computes the checksum of size bytes of data, which is what
+ * chksumfile_byinumber gives for a file holding exactly those bytes, for
+ * callers that have read the file themselves.  Returns the length of the
+ * checksum, or -1 on error.
+ */
+int chksumfile_bydata(const void *data, int size, void *chksum);
+
+/**
+ * Computes the checksums of numFiles inumbers at once, reading them through
+ * the batch b with as many reads in flight across all of them as it allows,
+ * so that a scan of many small files isn't held up by one read at a time.
+ * The checksum of inumbers[i] goes in the CHKSUMFILE_SIZE bytes at
+ * chksums + i*CHKSUMFILE_SIZE, and lengths[i] gets what chksumfile_byinumber
+ * would have returned for it.  The smaller files are read whole and then
+ * hashed together, SHA1MB_LANES at a time, with multi-buffer SHA-1 (see
+ * sha1mb.h).  With b NULL the files are read one at a time with file_read
+ * instead, through the sector cache, and the small ones still hashed
+ * together.  The batch is left empty, so a scan can make one and use it for
+ * every call.  Returns 0 on success, or -1 if the reads couldn't be set up
+ * or failed outright.
+ */
+int chksumfile_byinumbers(struct unixfilesystem *fs, const int *inumbers, int numFiles,
+                          void *chksums, int *lengths, struct diskbatch *b);
+
 /**
  * Compute the checksum of the specified pathname.  Assumes chksum points to a
  * CHKSUMFILE_SIZE byte array. Returns the length of the checksum or -1 if
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "dcache.h"
+
+#define DCACHE_NAMELEN 14           // the length of a name in a directory entry
+#define DCACHE_INITIAL_BUCKETS 256  // must be a power of two
+
+/**
+ * One name in one directory.  The directory itself is represented by an
+ * entry with an empty name (which no real entry has) once it's loaded.
+ */
+struct dentry {
+  int dirinumber;
+  struct direntv6 entry;
+  struct dentry *next;
+};
+
+struct dcache {
+  struct dentry **buckets;
+  int numBuckets;
+  int numEntries;
+  pthread_mutex_t lock;
+};
+
+static uint32_t dcache_hash(int dirinumber, const char *name) {
+  uint32_t h = 2166136261u ^ (uint32_t) dirinumber;
+  for (int i = 0; i < DCACHE_NAMELEN && name[i] != '\0'; i++) {
+    h = (h ^ (uint8_t) name[i]) * 16777619u;
+  }
+  return h;
+}
+
+static struct dentry *dcache_find(struct dcache *dc, int dirinumber, const char *name) {
+  struct dentry *e = dc->buckets[dcache_hash(dirinumber, name) & (dc->numBuckets - 1)];
+  while (e != NULL && (e->dirinumber != dirinumber || strncmp(e->entry.d_name, name, DCACHE_NAMELEN) != 0)) {
+    e = e->next;
+  }
+  return e;
+}
+
+/**
+ * Doubles the number of buckets, keeping the chains short.  Leaves the table
+ * as it is if there isn't memory for more.
+ */
+static void dcache_grow(struct dcache *dc) {
+  int numBuckets = 2 * dc->numBuckets;
+  struct dentry **buckets = calloc(numBuckets, sizeof(struct dentry *));
+  if (buckets == NULL) return;
+  for (int b = 0; b < dc->numBuckets; b++) {
+    struct dentry *e = dc->buckets[b];
+    while (e != NULL) {
+      struct dentry *next = e->next;
+      struct dentry **bucket = &buckets[dcache_hash(e->dirinumber, e->entry.d_name) & (numBuckets - 1)];
+      e->next = *bucket;
+      *bucket = e;
+      e = next;
+    }
+  }
+  free(dc->buckets);
+  dc->buckets = buckets;
+  dc->numBuckets = numBuckets;
+}
+
+static void dcache_add(struct dcache *dc, int dirinumber, const struct direntv6 *dirEnt) {
+  if (dcache_find(dc, dirinumber, dirEnt->d_name) != NULL) return;
+  struct dentry *e = malloc(sizeof(struct dentry));
+  if (e == NULL) return;  // it's only a cache
+  e->dirinumber = dirinumber;
+  e->entry = *dirEnt;
+  if (dc->numEntries >= dc->numBuckets) dcache_grow(dc);
+  struct dentry **bucket = &dc->buckets[dcache_hash(dirinumber, dirEnt->d_name) & (dc->numBuckets - 1)];
+  e->next = *bucket;
+  *bucket = e;
+  dc->numEntries++;
+}
+
+struct dcache *dcache_create(void) {
+  struct dcache *dc = malloc(sizeof(struct dcache));
+  if (dc == NULL) return NULL;
+  dc->buckets = calloc(DCACHE_INITIAL_BUCKETS, sizeof(struct dentry *));
+  if (dc->buckets == NULL) {
+    free(dc);
+    return NULL;
+  }
+  dc->numBuckets = DCACHE_INITIAL_BUCKETS;
+  dc->numEntries = 0;
+  pthread_mutex_init(&dc->lock, NULL);
+  return dc;
+}
+
+void dcache_free(struct dcache *dc) {
+  if (dc == NULL) return;
+  for (int b = 0; b < dc->numBuckets; b++) {
+    struct dentry *e = dc->buckets[b];
+    while (e != NULL) {
+      struct dentry *next = e->next;
+      free(e);
+      e = next;
+    }
+  }
+  free(dc->buckets);
+  pthread_mutex_destroy(&dc->lock);
+  free(dc);
+}
+
+int dcache_lookup(struct dcache *dc, int dirinumber, const char *name, struct direntv6 *dirEnt) {
+  if (name[0] == '\0') return -1;
+  pthread_mutex_lock(&dc->lock);
+  int found = -1;
+  struct dentry *e = dcache_find(dc, dirinumber, name);
+  if (e != NULL) {
+    *dirEnt = e->entry;
+    found = 1;
+  } else if (dcache_find(dc, dirinumber, "") != NULL) {
+    found = 0;
+  }
+  pthread_mutex_unlock(&dc->lock);
+  return found;
+}
+
+void dcache_insert(struct dcache *dc, int dirinumber, const struct direntv6 *dirEnt) {
+  if (dirEnt->d_name[0] == '\0') return;  // that's how loaded directories are marked
+  pthread_mutex_lock(&dc->lock);
+  dcache_add(dc, dirinumber, dirEnt);
+  pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_markloaded(struct dcache *dc, int dirinumber) {
+  struct direntv6 marker = { 0, "" };
+  pthread_mutex_lock(&dc->lock);
+  dcache_add(dc, dirinumber, &marker);
+  pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_forget(struct dcache *dc, int dirinumber) {
+  pthread_mutex_lock(&dc->lock);
+  for (int b = 0; b < dc->numBuckets; b++) {
+    struct dentry **link = &dc->buckets[b];
+    while (*link != NULL) {
+      struct dentry *e = *link;
+      if (e->dirinumber != dirinumber) {
+        link = &e->next;
+        continue;
+      }
+      *link = e->next;
+      free(e);
+      dc->numEntries--;
+    }
+  }
+  pthread_mutex_unlock(&dc->lock);
+}
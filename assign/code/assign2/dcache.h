@@ -0,0 +1,55 @@
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+#include "direntv6.h"
+
+/**
+ * A directory name cache: remembers which inumber each name in a directory
+ * refers to, so that looking up the same names over and over (as resolving
+ * many paths through the same directories does) takes a hash probe per path
+ * component rather than a scan of each directory.  A directory's entries
+ * are added all at once, the first time any name in it is looked up, after
+ * which the cache also knows which names aren't in it.
+ *
+ * One cache can be shared by any number of threads.
+ */
+struct dcache;
+
+/**
+ * Creates an empty cache.  Returns NULL if there isn't memory for it.
+ */
+struct dcache *dcache_create(void);
+
+/**
+ * Releases a cache made by dcache_create.
+ */
+void dcache_free(struct dcache *dc);
+
+/**
+ * Looks up name (of which only the first 14 characters count, as in a
+ * directory entry) in the directory with the specified inumber.  Returns 1
+ * and copies the entry into dirEnt if the name is known, 0 if the directory
+ * has been loaded and the name isn't in it, and -1 if the directory hasn't
+ * been loaded.  The empty name is never known.
+ */
+int dcache_lookup(struct dcache *dc, int dirinumber, const char *name, struct direntv6 *dirEnt);
+
+/**
+ * Records an entry of the specified directory.  If the directory already has
+ * an entry with the same name, the first one stays.
+ */
+void dcache_insert(struct dcache *dc, int dirinumber, const struct direntv6 *dirEnt);
+
+/**
+ * Records that every entry in the specified directory has been inserted, so
+ * names not in the cache aren't in the directory.
+ */
+void dcache_markloaded(struct dcache *dc, int dirinumber);
+
+/**
+ * Forgets everything about the specified directory, which has changed in a
+ * way the cache can't just be told about.
+ */
+void dcache_forget(struct dcache *dc, int dirinumber);
+
+#endif // _DCACHE_H_
@@ -2,33 +2,122 @@
 #include "inode.h"
 #include "diskimg.h"
 #include "file.h"
+#include "dcache.h"
+#include "fsstats.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
-int directory_findname(struct unixfilesystem *fs, const char *name,
-		       int dirinumber, struct direntv6 *dirEnt) {
+static int findname(struct unixfilesystem *fs, const char *name,
+		    int dirinumber, struct direntv6 *dirEnt) {
+	if (fs->dcache != NULL) {
+		int known = dcache_lookup(fs->dcache, dirinumber, name, dirEnt);
+		if (known == 1) {
+			fsstats_count(FSSTATS_DCACHE_HITS, 1);
+			return 0;
+		}
+		if (known == 0) {
+			fsstats_count(FSSTATS_DCACHE_NEGATIVES, 1);
+			fprintf(stderr, "No file with matching name found in the directory.\n");
+			return -1;
+		}
+	}
+
 	struct inode in;
 	if (inode_iget(fs, dirinumber, &in) < 0) return -1;
 	if ((in.i_mode & IFMT) != IFDIR || (in.i_mode & IALLOC) == 0) {
 		fprintf(stderr, "File with inumber %d is not a directory or not allocated.\n", dirinumber);
 		return -1;
 	}
+	fsstats_count(FSSTATS_DIRECTORY_SCANS, 1);
 	int size = inode_getsize(&in);
 	int num_block = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
 	struct direntv6 buf[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
+	int found = 0;
 	for (int block_num=0; block_num < num_block; block_num++) {
-		// get content from each block in directory
-		int read_bytes = file_getblock(fs, dirinumber, block_num, buf);
-		if (read_bytes < 0) return -1;
+		// look over each block of the directory where it sits, if the image is mapped
+		int block_add = inode_indexlookup(fs, &in, block_num);
+		if (block_add < 0) return -1;
+		const struct direntv6 *entries = diskimg_getsector(fs->dfd, block_add, buf);
+		if (entries == NULL) return -1;
+		int read_bytes = block_num == num_block - 1 ? size - block_num * DISKIMG_SECTOR_SIZE : DISKIMG_SECTOR_SIZE;
 		int num_file = read_bytes / sizeof(struct direntv6);
 		for (int i=0; i<num_file; i++) {
-			if (strncmp(buf[i].d_name, name, 14) == 0) {
-				*dirEnt = buf[i];
-				return 0;
+			if (!found && strncmp(entries[i].d_name, name, 14) == 0) {
+				*dirEnt = entries[i];
+				found = 1;
+				// without a cache to fill, there's no reason to read on
+				if (fs->dcache == NULL) return 0;
 			}
+			// remember every name, so the rest of the directory needn't be searched again
+			if (fs->dcache != NULL) dcache_insert(fs->dcache, dirinumber, &entries[i]);
 		}
 	}
+	if (fs->dcache != NULL) dcache_markloaded(fs->dcache, dirinumber);
+	if (found) return 0;
 	fprintf(stderr, "No file with matching name found in the directory.\n");
 	return -1;
 }
+
+int directory_findname(struct unixfilesystem *fs, const char *name,
+		       int dirinumber, struct direntv6 *dirEnt) {
+	struct fsstats_span span = fsstats_begin();
+	int err = findname(fs, name, dirinumber, dirEnt);
+	fsstats_end(FSSTATS_FINDNAME, span);
+	return err;
+}
+
+void directory_remember(struct unixfilesystem *fs, int dirinumber,
+			const struct direntv6 *entries, int numEntries) {
+	if (fs->dcache == NULL) return;
+	for (int i = 0; i < numEntries; i++) dcache_insert(fs->dcache, dirinumber, &entries[i]);
+	dcache_markloaded(fs->dcache, dirinumber);
+}
+
+int directory_addentry(struct unixfilesystem *fs, int dirinumber, const char *name, int inumber) {
+	struct file *f = file_open(fs, dirinumber);
+	if (f == NULL) return -1;
+	if ((f->in.i_mode & IFMT) != IFDIR || (f->in.i_mode & IALLOC) == 0) {
+		file_close(f);
+		return -1;
+	}
+
+	// look through the whole directory, for a free slot and for the name already being there
+	int freeSlot = -1;
+	int size = f->size;
+	for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
+		struct direntv6 entries[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
+		int bytes = file_read(f, offset, entries, sizeof(entries));
+		if (bytes <= 0) {
+			file_close(f);
+			return -1;
+		}
+		for (int i = 0; i < bytes / (int) sizeof(struct direntv6); i++) {
+			if (entries[i].d_inumber == 0) {
+				if (freeSlot < 0) freeSlot = offset + i * sizeof(struct direntv6);
+			} else if (strncmp(entries[i].d_name, name, sizeof(entries[i].d_name)) == 0) {
+				fprintf(stderr, "%s is already in directory %d.\n", name, dirinumber);
+				file_close(f);
+				return -1;
+			}
+		}
+	}
+
+	struct direntv6 entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.d_inumber = inumber;
+	strncpy(entry.d_name, name, sizeof(entry.d_name));
+	int offset = freeSlot >= 0 ? freeSlot : size;
+	int err = file_write(f, offset, &entry, sizeof(entry)) < 0 || file_sync(f) < 0 ? -1 : 0;
+	file_close(f);
+
+	if (fs->dcache != NULL) {
+		// A reused slot may have had a name the cache still remembers.
+		if (freeSlot >= 0 || err < 0) {
+			dcache_forget(fs->dcache, dirinumber);
+		} else {
+			dcache_insert(fs->dcache, dirinumber, &entry);
+		}
+	}
+	return err;
+}
@@ -12,4 +12,20 @@
 int directory_findname(struct unixfilesystem *fs, const char *name,
                        int dirinumber, struct direntv6 *dirEnt);
 
+/**
+ * Records every entry of the specified directory, read by the caller, so
+ * that looking names up in it doesn't read it all over again.  entries must
+ * be the whole directory, in order.
+ */
+void directory_remember(struct unixfilesystem *fs, int dirinumber,
+                        const struct direntv6 *entries, int numEntries);
+
+/**
+ * Adds an entry for inumber, called name, to the specified directory,
+ * reusing the first free slot it has (one whose inumber is 0) or else adding
+ * to the end.  Returns 0 on success, and something negative on failure,
+ * which includes the directory already having an entry of that name.
+ */
+int directory_addentry(struct unixfilesystem *fs, int dirinumber, const char *name, int inumber);
+
 #endif // _DIECTORY_H_
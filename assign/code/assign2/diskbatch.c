@@ -0,0 +1,419 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "diskbatch.h"
+#include "diskimg.h"
+#include "fsstats.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#define MAX_THREADS 8   // most pread threads a batch will start
+
+enum backend { BACKEND_MAPPED, BACKEND_URING, BACKEND_THREADS };
+
+/**
+ * One read, from the time it's queued until it's collected.
+ */
+struct request {
+  struct iovec iov;   // the buffer and its length
+  off_t offset;
+  void *tag;
+  int result;
+};
+
+/**
+ * A first-in first-out list of request slots, which never has to hold more
+ * than depth of them.
+ */
+struct slotqueue {
+  int *slots;
+  int first, count;
+};
+
+#ifdef HAVE_IO_URING
+/**
+ * The parts of an io_uring this needs: the submission and completion rings
+ * the kernel shares with us, and the array of submission entries.
+ */
+struct uring {
+  int fd;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_cqe *cqes;
+  void *sqRing, *cqRing;
+  size_t sqRingSize, cqRingSize, sqesSize;
+};
+#endif
+
+struct diskbatch {
+  int fd;
+  int depth;
+  enum backend backend;
+  struct request *requests;   // depth of them
+  struct slotqueue unused;    // slots free for new requests
+  struct slotqueue queued;    // queued but not issued yet
+  struct slotqueue finished;  // finished but not collected yet
+  int outstanding;
+
+#ifdef HAVE_IO_URING
+  struct uring ring;
+#endif
+
+  // The thread backend: issued requests wait in pending for a thread.
+  pthread_t threads[MAX_THREADS];
+  int numThreads;
+  struct slotqueue pending;
+  pthread_mutex_t lock;
+  pthread_cond_t workReady;
+  pthread_cond_t workDone;
+  int shuttingDown;
+};
+
+static void slotqueue_push(struct slotqueue *q, int depth, int slot) {
+  q->slots[(q->first + q->count++) % depth] = slot;
+}
+
+static int slotqueue_pop(struct slotqueue *q, int depth) {
+  int slot = q->slots[q->first];
+  q->first = (q->first + 1) % depth;
+  q->count--;
+  return slot;
+}
+
+/**
+ * Reads the whole of a request with pread, which may take a few calls.
+ * Returns the number of bytes read, or -1 on error.
+ */
+static int read_fully(int fd, struct request *r, size_t alreadyRead) {
+  size_t bytesRead = alreadyRead;
+  while (bytesRead < r->iov.iov_len) {
+    ssize_t n = pread(fd, (char *) r->iov.iov_base + bytesRead, r->iov.iov_len - bytesRead,
+                      r->offset + bytesRead);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    if (n == 0) break;
+    bytesRead += n;
+  }
+  return bytesRead;
+}
+
+#ifdef HAVE_IO_URING
+static int uring_setup(struct uring *u, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0) return -1;
+
+  u->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) {
+    if (u->cqRingSize > u->sqRingSize) u->sqRingSize = u->cqRingSize;
+    u->cqRingSize = u->sqRingSize;
+  }
+  u->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  u->cqRing = singleMap ? u->sqRing
+                        : mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  void *sqes = mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqRing == MAP_FAILED || u->cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+    if (u->sqRing != MAP_FAILED) munmap(u->sqRing, u->sqRingSize);
+    if (!singleMap && u->cqRing != MAP_FAILED) munmap(u->cqRing, u->cqRingSize);
+    if (sqes != MAP_FAILED) munmap(sqes, u->sqesSize);
+    close(u->fd);
+    return -1;
+  }
+  if (singleMap) u->cqRingSize = 0;   // so it isn't unmapped twice
+
+  char *sq = u->sqRing, *cq = u->cqRing;
+  u->sqHead = (unsigned *) (sq + p.sq_off.head);
+  u->sqTail = (unsigned *) (sq + p.sq_off.tail);
+  u->sqMask = (unsigned *) (sq + p.sq_off.ring_mask);
+  u->sqArray = (unsigned *) (sq + p.sq_off.array);
+  u->sqes = sqes;
+  u->cqHead = (unsigned *) (cq + p.cq_off.head);
+  u->cqTail = (unsigned *) (cq + p.cq_off.tail);
+  u->cqMask = (unsigned *) (cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  return 0;
+}
+
+static void uring_teardown(struct uring *u) {
+  munmap(u->sqes, u->sqesSize);
+  if (u->cqRingSize > 0) munmap(u->cqRing, u->cqRingSize);
+  munmap(u->sqRing, u->sqRingSize);
+  close(u->fd);
+}
+
+/**
+ * Hands every queued request to the kernel, and waits for at least
+ * minComplete of the batch's requests to complete.
+ */
+static int uring_submit(struct diskbatch *b, unsigned minComplete) {
+  struct uring *u = &b->ring;
+  unsigned tail = *u->sqTail;
+  unsigned toSubmit = b->queued.count;
+  while (b->queued.count > 0) {
+    int slot = slotqueue_pop(&b->queued, b->depth);
+    struct request *r = &b->requests[slot];
+    unsigned index = tail & *u->sqMask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = b->fd;
+    sqe->addr = (unsigned long) &r->iov;
+    sqe->len = 1;
+    sqe->off = r->offset;
+    sqe->user_data = slot;
+    u->sqArray[index] = index;
+    tail++;
+  }
+  __atomic_store_n(u->sqTail, tail, __ATOMIC_RELEASE);
+
+  unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (toSubmit > 0 || minComplete > 0) {
+    int n = syscall(__NR_io_uring_enter, u->fd, toSubmit, minComplete, flags, NULL, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    toSubmit -= n;
+    minComplete = 0;
+  }
+  return 0;
+}
+
+/**
+ * Moves every completion the kernel has posted onto the finished list.
+ */
+static void uring_reap(struct diskbatch *b) {
+  struct uring *u = &b->ring;
+  unsigned head = *u->cqHead;
+  unsigned tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+    int slot = cqe->user_data;
+    struct request *r = &b->requests[slot];
+    r->result = cqe->res;
+    if (cqe->res > 0 && (size_t) cqe->res < r->iov.iov_len) {
+      r->result = read_fully(b->fd, r, cqe->res);   // rare; finish it by hand
+    } else if (cqe->res < 0) {
+      r->result = -1;
+    }
+    slotqueue_push(&b->finished, b->depth, slot);
+    head++;
+  }
+  __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gets the batch back to empty after a submit or wait has failed.  Entries
+ * the kernel never picked up are taken back out of the ring, and whatever it
+ * did pick up is waited for, however long that takes, since until it
+ * completes the kernel may still be reading into the request's buffer.
+ */
+static void uring_drain(struct diskbatch *b) {
+  struct uring *u = &b->ring;
+  unsigned head = __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE);
+  int unsubmitted = *u->sqTail - head;
+  __atomic_store_n(u->sqTail, head, __ATOMIC_RELEASE);
+
+  uring_reap(b);
+  int inKernel = b->outstanding - b->queued.count - b->finished.count - unsubmitted;
+  while (inKernel > 0) {
+    int finished = b->finished.count;
+    if (syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      sched_yield();    // completions are posted whether or not anyone waits
+    }
+    uring_reap(b);
+    inKernel -= b->finished.count - finished;
+  }
+
+  b->unused.first = b->unused.count = 0;
+  b->queued.first = b->queued.count = 0;
+  b->finished.first = b->finished.count = 0;
+  for (int slot = 0; slot < b->depth; slot++) slotqueue_push(&b->unused, b->depth, slot);
+  b->outstanding = 0;
+}
+#endif
+
+static void *batch_worker(void *arg) {
+  struct diskbatch *b = arg;
+  pthread_mutex_lock(&b->lock);
+  while (1) {
+    while (b->pending.count == 0 && !b->shuttingDown) pthread_cond_wait(&b->workReady, &b->lock);
+    if (b->pending.count == 0) break;
+    int slot = slotqueue_pop(&b->pending, b->depth);
+    pthread_mutex_unlock(&b->lock);
+    struct request *r = &b->requests[slot];
+    r->result = read_fully(b->fd, r, 0);
+    pthread_mutex_lock(&b->lock);
+    slotqueue_push(&b->finished, b->depth, slot);
+    pthread_cond_signal(&b->workDone);
+  }
+  pthread_mutex_unlock(&b->lock);
+  return NULL;
+}
+
+static int start_threads(struct diskbatch *b) {
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->workReady, NULL);
+  pthread_cond_init(&b->workDone, NULL);
+  int wanted = b->depth < MAX_THREADS ? b->depth : MAX_THREADS;
+  while (b->numThreads < wanted &&
+         pthread_create(&b->threads[b->numThreads], NULL, batch_worker, b) == 0) {
+    b->numThreads++;
+  }
+  return b->numThreads > 0 ? 0 : -1;
+}
+
+struct diskbatch *diskbatch_create(int fd, int depth) {
+  if (depth < 1) return NULL;
+  struct diskbatch *b = calloc(1, sizeof(struct diskbatch));
+  if (b == NULL) return NULL;
+  b->fd = fd;
+  b->depth = depth;
+  b->requests = calloc(depth, sizeof(struct request));
+  b->unused.slots = malloc(depth * sizeof(int));
+  b->queued.slots = malloc(depth * sizeof(int));
+  b->finished.slots = malloc(depth * sizeof(int));
+  b->pending.slots = malloc(depth * sizeof(int));
+  if (b->requests == NULL || b->unused.slots == NULL || b->queued.slots == NULL ||
+      b->finished.slots == NULL || b->pending.slots == NULL) {
+    diskbatch_free(b);
+    return NULL;
+  }
+  for (int slot = 0; slot < depth; slot++) slotqueue_push(&b->unused, depth, slot);
+
+  b->backend = BACKEND_THREADS;
+  if (diskimg_ismapped(fd)) {
+    b->backend = BACKEND_MAPPED;
+    return b;
+  }
+#ifdef HAVE_IO_URING
+  if (uring_setup(&b->ring, depth) == 0) {
+    b->backend = BACKEND_URING;
+    return b;
+  }
+#endif
+  if (start_threads(b) < 0) {
+    diskbatch_free(b);
+    return NULL;
+  }
+  return b;
+}
+
+int diskbatch_read(struct diskbatch *b, int firstSector, int numSectors, void *buf, void *tag) {
+  if (b->unused.count == 0 || firstSector < 0 || numSectors < 1) return -1;
+  int slot = slotqueue_pop(&b->unused, b->depth);
+  struct request *r = &b->requests[slot];
+  r->iov.iov_base = buf;
+  r->iov.iov_len = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+  r->offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  r->tag = tag;
+  b->outstanding++;
+
+  if (b->backend == BACKEND_MAPPED) {
+    r->result = diskimg_readsectors(b->fd, firstSector, numSectors, buf);
+    slotqueue_push(&b->finished, b->depth, slot);
+  } else {
+    slotqueue_push(&b->queued, b->depth, slot);
+  }
+  return 0;
+}
+
+int diskbatch_wait(struct diskbatch *b, int minDone, struct diskbatch_completion *done, int maxDone) {
+  if (minDone > b->outstanding) minDone = b->outstanding;
+  if (minDone > maxDone) minDone = maxDone;
+
+  if (b->backend == BACKEND_THREADS) {
+    pthread_mutex_lock(&b->lock);
+    while (b->queued.count > 0) slotqueue_push(&b->pending, b->depth, slotqueue_pop(&b->queued, b->depth));
+    pthread_cond_broadcast(&b->workReady);
+    while (b->finished.count < minDone) pthread_cond_wait(&b->workDone, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+  }
+#ifdef HAVE_IO_URING
+  if (b->backend == BACKEND_URING) {
+    uring_reap(b);
+    unsigned needed = b->finished.count < minDone ? minDone - b->finished.count : 0;
+    if ((b->queued.count > 0 || needed > 0) && uring_submit(b, needed) < 0) return -1;
+    uring_reap(b);
+  }
+#endif
+
+  if (b->backend == BACKEND_THREADS) pthread_mutex_lock(&b->lock);
+  int numDone = 0;
+  while (numDone < maxDone && b->finished.count > 0) {
+    int slot = slotqueue_pop(&b->finished, b->depth);
+    struct request *r = &b->requests[slot];
+    done[numDone].tag = r->tag;
+    done[numDone].result = r->result;
+    numDone++;
+    if (b->backend != BACKEND_MAPPED && r->result > 0) {
+      fsstats_count(FSSTATS_SECTOR_READS, 1);
+      fsstats_count(FSSTATS_SECTORS_READ, r->result / DISKIMG_SECTOR_SIZE);
+    }
+    slotqueue_push(&b->unused, b->depth, slot);
+    b->outstanding--;
+  }
+  if (b->backend == BACKEND_THREADS) pthread_mutex_unlock(&b->lock);
+  return numDone;
+}
+
+int diskbatch_outstanding(struct diskbatch *b) {
+  return b->outstanding;
+}
+
+int diskbatch_depth(struct diskbatch *b) {
+  return b->depth;
+}
+
+const char *diskbatch_backend(struct diskbatch *b) {
+  static const char *kNames[] = { "mapped", "io_uring", "threads" };
+  return kNames[b->backend];
+}
+
+void diskbatch_drain(struct diskbatch *b) {
+  struct diskbatch_completion done[16];
+  while (b->outstanding > 0 && diskbatch_wait(b, 1, done, 16) >= 0) {}
+#ifdef HAVE_IO_URING
+  if (b->backend == BACKEND_URING && b->outstanding > 0) uring_drain(b);
+#endif
+}
+
+void diskbatch_free(struct diskbatch *b) {
+  if (b->outstanding > 0) diskbatch_drain(b);
+#ifdef HAVE_IO_URING
+  if (b->backend == BACKEND_URING) uring_teardown(&b->ring);
+#endif
+  if (b->numThreads > 0) {
+    pthread_mutex_lock(&b->lock);
+    b->shuttingDown = 1;
+    pthread_cond_broadcast(&b->workReady);
+    pthread_mutex_unlock(&b->lock);
+    for (int t = 0; t < b->numThreads; t++) pthread_join(b->threads[t], NULL);
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->workReady);
+    pthread_cond_destroy(&b->workDone);
+  }
+  free(b->requests);
+  free(b->unused.slots);
+  free(b->queued.slots);
+  free(b->finished.slots);
+  free(b->pending.slots);
+  free(b);
+}
@@ -0,0 +1,78 @@
+#ifndef _DISKBATCH_H_
+#define _DISKBATCH_H_
+
+/**
+ * Asynchronous sector reads for scans that know well ahead of time what they
+ * will need.  Reads are queued on a batch and issued together, many at once,
+ * and their completions are collected later, in whatever order they finish.
+ * Where the kernel supports io_uring the reads go through one; otherwise a
+ * small pool of threads issues them with pread.  Reads from a mapped image
+ * are just copied, and complete as soon as they're queued.
+ *
+ * Batches read the image itself, so anything written back through the
+ * sector cache should be flushed first.  A batch may be handed from thread
+ * to thread, but only one may use it at a time.
+ */
+struct diskbatch;
+
+/**
+ * What became of one read: the tag it was queued with, and the number of
+ * bytes read (short only at the end of the image) or -1 on error.
+ */
+struct diskbatch_completion {
+  void *tag;
+  int result;
+};
+
+/**
+ * Makes a batch for the open image fd that allows up to depth reads to be
+ * outstanding (queued or in flight, but not yet collected) at once.
+ * Returns NULL on error.
+ */
+struct diskbatch *diskbatch_create(int fd, int depth);
+
+/**
+ * Queues a read of numSectors sectors, starting with firstSector, into buf,
+ * which must stay put until the read is collected.  Returns 0 on success, or
+ * -1 if depth reads are already outstanding.
+ */
+int diskbatch_read(struct diskbatch *b, int firstSector, int numSectors, void *buf, void *tag);
+
+/**
+ * Issues everything queued, then waits until at least minDone reads (but no
+ * more than are outstanding) have finished, and collects up to maxDone of
+ * them into done.  Returns the number collected, or -1 on error, after
+ * which the batch should be drained before it's used again or any of the
+ * buffers still being read into are let go.
+ */
+int diskbatch_wait(struct diskbatch *b, int minDone, struct diskbatch_completion *done, int maxDone);
+
+/**
+ * Returns how many reads are outstanding.
+ */
+int diskbatch_outstanding(struct diskbatch *b);
+
+/**
+ * Returns how many reads can be outstanding at once.
+ */
+int diskbatch_depth(struct diskbatch *b);
+
+/**
+ * Waits for every outstanding read to finish, throwing away the results,
+ * so that the buffers they were reading into can be let go.  Even if the
+ * reads fail, this doesn't return until none of them can still be writing
+ * to their buffers, and it leaves the batch empty and ready to use again.
+ */
+void diskbatch_drain(struct diskbatch *b);
+
+/**
+ * Names the way the batch is reading: "io_uring", "threads" or "mapped".
+ */
+const char *diskbatch_backend(struct diskbatch *b);
+
+/**
+ * Drains the batch of anything still outstanding, then releases it.
+ */
+void diskbatch_free(struct diskbatch *b);
+
+#endif // _DISKBATCH_H_
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "diskimg.h"
 #include "unixfilesystem.h"
@@ -12,20 +13,31 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "fsstats.h"
+#include "chksumcache.h"
+#include "diskbatch.h"
 
 int quietFlag = 0; 
 int idumpFlag = 0;
 int pdumpFlag = 0;
+int mapFlag = 0;
+int cacheSectors = DISKIMG_DEFAULT_CACHE_SECTORS;
+int numThreads = 1;
+int statsFlag = 0;
+int asyncDepth = 0;
+char *cachePath = NULL;
+struct chksumcache *digestCache = NULL;
 
 static void PrintDirectory(struct unixfilesystem *fs,  char *pathname);
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f);
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f);
+static void PrintCacheStats(int fd);
 static void PrintUsageAndExit(char *progname);
 static int GetDirEntries(struct unixfilesystem *fs, int inumber, struct direntv6 *entries, int maxNumEntries);
 
 int main(int argc, char *argv[]) {
   int opt;
-  while ((opt = getopt(argc, argv, "iqp")) != -1) {
+  while ((opt = getopt(argc, argv, "iqpmsc:j:a:k:")) != -1) {
     switch (opt) {
     case 'q':
       quietFlag = 1;
@@ -36,6 +48,27 @@ int main(int argc, char *argv[]) {
     case 'p':
       pdumpFlag = 1;
       break;
+    case 'm':
+      mapFlag = 1;
+      break;
+    case 's':
+      statsFlag = 1;
+      break;
+    case 'c':
+      cacheSectors = atoi(optarg);
+      if (cacheSectors < 0) PrintUsageAndExit(argv[0]);
+      break;
+    case 'j':
+      numThreads = atoi(optarg);
+      if (numThreads < 1) PrintUsageAndExit(argv[0]);
+      break;
+    case 'a':
+      asyncDepth = atoi(optarg);
+      if (asyncDepth < 1) PrintUsageAndExit(argv[0]);
+      break;
+    case 'k':
+      cachePath = optarg;
+      break;
     default: 
       PrintUsageAndExit(argv[0]);
     } 
@@ -46,13 +79,18 @@ int main(int argc, char *argv[]) {
   }
 
   char *diskpath = argv[optind];
-  int fd = diskimg_open(diskpath, 1);
+  int fd = diskimg_openbackend(diskpath, 1, mapFlag ? DISKIMG_MAPPED : DISKIMG_BUFFERED);
 
   if (fd < 0) {
     fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
     exit(EXIT_FAILURE);
   }
 
+  if (!mapFlag && diskimg_setcachesize(fd, cacheSectors) < 0) {
+    fprintf(stderr, "Can't allocate a %d sector cache\n", cacheSectors);
+    exit(EXIT_FAILURE);
+  }
+
   struct unixfilesystem *fs = unixfilesystem_init(fd);
   if (!fs) {
     fprintf(stderr, "Failed to initialize unix filesystem\n");
@@ -66,7 +104,7 @@ int main(int argc, char *argv[]) {
       // Cast the result of diskimg_close to void so the compiler doesn't
       // complain that we're ignoring its return value.
       (void) diskimg_close(fd);
-      free(fs);
+      unixfilesystem_free(fs);
       exit(EXIT_FAILURE);
     }
     printf("Disk %s is %d bytes (%d KB)\n", argv[1],  disksize, disksize/1024);
@@ -76,121 +114,494 @@ int main(int argc, char *argv[]) {
     printf("Superblock s_ninode %d\n",(int)fs->superblock.s_ninode);
   }
 
+  if (cachePath != NULL && (digestCache = chksumcache_open(fs, cachePath)) == NULL) {
+    fprintf(stderr, "Can't use %s as a checksum cache\n", cachePath);
+  }
+
+  if (statsFlag) fsstats_enable(1);
   if (idumpFlag) DumpInodeChecksum(fs, stdout);
   if (pdumpFlag) DumpPathnameChecksum(fs, stdout);
+  if (digestCache != NULL) {
+    if (chksumcache_save(digestCache) < 0) fprintf(stderr, "Error saving the checksum cache %s\n", cachePath);
+    chksumcache_close(digestCache);
+  }
+  if (!quietFlag || statsFlag) PrintCacheStats(fd);
+  if (statsFlag) fsstats_report(stderr);
 
   int err = diskimg_close(fd);
   if (err < 0) fprintf(stderr, "Error closing %s\n", argv[1]);
-  free(fs);
+  unixfilesystem_free(fs);
   exit(EXIT_SUCCESS);
   return 0;
 }
 
 /**
- * Output to the specified file the checksum of all allocated inodes.
+ * Calls work(context, item) for every item in [0, numItems), spread across
+ * numThreads threads (the calling thread being one of them) that each claim
+ * the next item nobody has claimed yet.  With one thread everything happens
+ * on the calling thread, in order.
+ */
+struct parallelrun {
+  void (*work)(void *context, int item);
+  void *context;
+  int numItems;
+  int next;
+};
+
+static void *ParallelWorker(void *arg) {
+  struct parallelrun *run = arg;
+  int item;
+  while ((item = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->numItems) {
+    run->work(run->context, item);
+  }
+  return NULL;
+}
+
+static void RunInParallel(int numThreads, int numItems, void (*work)(void *, int), void *context) {
+  struct parallelrun run = { work, context, numItems, 0 };
+  pthread_t threads[numThreads];
+  int numStarted = 0;
+  while (numStarted < numThreads - 1 && numStarted < numItems &&
+         pthread_create(&threads[numStarted], NULL, ParallelWorker, &run) == 0) {
+    numStarted++;
+  }
+  ParallelWorker(&run);
+  for (int t = 0; t < numStarted; t++) pthread_join(threads[t], NULL);
+}
+
+/**
+ * What became of checksumming one inode or one path, kept until it's that
+ * entry's turn to be printed.
+ */
+enum jobstatus {
+  JOB_OK,
+  JOB_NO_CHKSUM,      // couldn't checksum by inumber (or, for a path, by either)
+  JOB_MISMATCH        // the path and inode checksums differ
+};
+
+struct inodejob {
+  int inumber;
+  struct inode in;
+  enum jobstatus status;
+  char chksum[CHKSUMFILE_SIZE];
+};
+
+struct inodebatch {
+  struct unixfilesystem *fs;
+  struct inodejob *jobs;
+  int numJobs;
+  int chunkSize;    // jobs per work item
+  struct diskbatch **readers;   // one for each work item, or NULL to use file_read
+};
+
+/**
+ * Checksums an inode by inumber, unless the checksum cache (if there is one)
+ * already knows it, in which case no data need be read.
+ */
+static int ChecksumByInumber(struct unixfilesystem *fs, int inumber, const struct inode *in, void *chksum) {
+  if (digestCache != NULL && chksumcache_lookup(digestCache, inumber, in, chksum)) return CHKSUMFILE_SIZE;
+  int length = chksumfile_byinumber(fs, inumber, chksum);
+  if (length >= 0 && digestCache != NULL) chksumcache_store(digestCache, inumber, in, chksum);
+  return length;
+}
+
+static void ChecksumInode(void *context, int item) {
+  struct inodebatch *batch = context;
+  struct inodejob *job = &batch->jobs[item];
+  if (ChecksumByInumber(batch->fs, job->inumber, &job->in, job->chksum) < 0) {
+    job->status = JOB_NO_CHKSUM;
+  } else {
+    job->status = JOB_OK;
+  }
+}
+
+/**
+ * Checksums one chunk of a batch with chksumfile_byinumbers, so that the
+ * small files among its inodes are hashed together and, with asyncDepth
+ * set, the reads for all of them overlap, asyncDepth at a time.
+ */
+static void ChecksumInodeChunk(void *context, int item) {
+  struct inodebatch *batch = context;
+  int first = item * batch->chunkSize;
+  int numJobs = batch->numJobs - first < batch->chunkSize ? batch->numJobs - first : batch->chunkSize;
+  int inumbers[numJobs], lengths[numJobs], misses[numJobs];
+  char chksums[numJobs][CHKSUMFILE_SIZE];
+  int numMisses = 0;
+  for (int i = 0; i < numJobs; i++) {
+    struct inodejob *job = &batch->jobs[first + i];
+    if (digestCache != NULL && chksumcache_lookup(digestCache, job->inumber, &job->in, job->chksum)) {
+      job->status = JOB_OK;
+      continue;
+    }
+    misses[numMisses] = first + i;
+    inumbers[numMisses++] = job->inumber;
+  }
+  if (numMisses == 0) return;
+
+  struct diskbatch *reader = batch->readers != NULL ? batch->readers[item] : NULL;
+  if (chksumfile_byinumbers(batch->fs, inumbers, numMisses, chksums, lengths, reader) < 0) {
+    for (int i = 0; i < numMisses; i++) ChecksumInode(batch, misses[i]);
+    return;
+  }
+  for (int i = 0; i < numMisses; i++) {
+    struct inodejob *job = &batch->jobs[misses[i]];
+    job->status = lengths[i] < 0 ? JOB_NO_CHKSUM : JOB_OK;
+    memcpy(job->chksum, chksums[i], CHKSUMFILE_SIZE);
+    if (lengths[i] >= 0 && digestCache != NULL) chksumcache_store(digestCache, job->inumber, &job->in, job->chksum);
+  }
+}
+
+/**
+ * Output to the specified file the checksum of all allocated inodes.  The
+ * inode table is scanned in order, and the allocated inodes it turns up are
+ * checksummed a batch at a time, each thread taking a share of the batch,
+ * and each batch printed in inumber order once it's done.  With asyncDepth
+ * set, each thread keeps asyncDepth reads in flight for its share, through
+ * a diskbatch of its own that's made once and used for the whole scan.
  *
  * This is used by the grading script, so be careful not to change its output
  * format.
  */
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f) {
-  for (int inumber = 1; inumber < fs->superblock.s_isize*16; inumber++) {
-    struct inode in;
-    if (inode_iget(fs, inumber, &in) < 0) {
-      fprintf(stderr,"Can't read inode %d \n", inumber);
-      return;
+  const int kBatchSize = 1024;
+  const int kScanSectors = 64;
+  struct inodejob *jobs = malloc(kBatchSize * sizeof(struct inodejob));
+  struct inodescan *scan = inode_scanbegin(fs, kScanSectors);
+  struct diskbatch **readers = asyncDepth > 0 ? calloc(numThreads, sizeof(struct diskbatch *)) : NULL;
+  if (jobs == NULL || scan == NULL || (asyncDepth > 0 && readers == NULL)) {
+    fprintf(stderr, "Out of memory.\n");
+    free(jobs);
+    free(readers);
+    if (scan != NULL) inode_scanend(scan);
+    return;
+  }
+  // a thread whose batch can't be made just reads with file_read
+  for (int t = 0; readers != NULL && t < numThreads; t++) readers[t] = diskbatch_create(fs->dfd, asyncDepth);
+
+  int endInumber = fs->superblock.s_isize*16;
+  int inumber = 1;
+  while (inumber > 0) {
+    int numJobs = 0;
+    while (numJobs < kBatchSize &&
+           (inumber = inode_scannext(scan, &jobs[numJobs].in)) > 0 && inumber < endInumber) {
+      jobs[numJobs++].inumber = inumber;
     }
-    if ((in.i_mode & IALLOC) == 0) {
-      // Skip this inode if it's not allocated.
+    if (inumber >= endInumber) inumber = 0;
+
+    struct inodebatch batch = { fs, jobs, numJobs, (numJobs + numThreads - 1) / numThreads, readers };
+    if (numJobs > 0) {
+      RunInParallel(numThreads, (numJobs + batch.chunkSize - 1) / batch.chunkSize, ChecksumInodeChunk, &batch);
+    }
+
+    for (int i = 0; i < numJobs; i++) {
+      struct inodejob *job = &jobs[i];
+      if (job->status == JOB_NO_CHKSUM) {
+        fprintf(stderr, "Inode %d can't compute chksum\n", job->inumber);
+        continue;
+      }
+
+      char chksumstring[CHKSUMFILE_STRINGSIZE];
+      chksumfile_cvt2string(job->chksum, chksumstring);
+
+      int size = inode_getsize(&job->in);
+      fprintf(f, "Inode %d mode 0x%x size %d checksum %s\n",job->inumber,job->in.i_mode, size, chksumstring);
+    }
+  }
+  if (inumber < 0) fprintf(stderr,"Can't read inode %d \n", inode_scanposition(scan));
+  inode_scanend(scan);
+  for (int t = 0; readers != NULL && t < numThreads; t++) {
+    if (readers[t] != NULL) diskbatch_free(readers[t]);
+  }
+  free(readers);
+  free(jobs);
+}
+
+/**
+ * One path found while walking the naming hierarchy, waiting its turn to be
+ * printed.  inumber is the entry the walk followed to get here, and resolved
+ * is what the pathname resolves to from the root (which is almost always
+ * the same, but needn't be in a directory with two entries of one name), or
+ * -1 if it doesn't.
+ */
+struct pathjob {
+  char *pathname;
+  int inumber;
+  int resolved;
+  struct inode in;
+  int ready;          // whether status and chksum have been filled in yet
+  enum jobstatus status;
+  char chksum[CHKSUMFILE_SIZE];
+};
+
+/**
+ * The state shared by the walk, the threads checksumming files and the
+ * printing.  Jobs sit in a ring, in the order they're printed, from the time
+ * the walk finds them until they're printed, so at most kPathWindow paths are
+ * held at once however big the image is.  Directories are checksummed by the
+ * walk itself, since it has to read them anyway, and files are left for the
+ * threads, which take them in order.
+ */
+#define kPathWindow 4096
+
+struct pathwalk {
+  struct unixfilesystem *fs;
+  FILE *out;
+  struct pathjob jobs[kPathWindow];
+  long numAdded;
+  long numClaimed;    // jobs a thread has picked up, or that needed no thread
+  long numPrinted;
+  int walkDone;
+  int numWorkers;
+  pthread_mutex_t lock;
+  pthread_cond_t jobAdded;
+  pthread_cond_t jobReady;
+};
+
+/**
+ * Fills in the checksum of a file found by the walk, and returns its status.
+ * Its data is only hashed once, unless its pathname resolves to some other
+ * inode.  Setting the status and marking the job ready is left to the
+ * caller, which has to do it under the lock once the job is in the ring.
+ */
+static enum jobstatus ChecksumPath(struct unixfilesystem *fs, struct pathjob *job) {
+  char chksum[CHKSUMFILE_SIZE];
+  if (ChecksumByInumber(fs, job->inumber, &job->in, job->chksum) < 0 || job->resolved < 0) {
+    return JOB_NO_CHKSUM;
+  } else if (job->resolved == job->inumber) {
+    return JOB_OK;
+  } else if (chksumfile_byinumber(fs, job->resolved, chksum) < 0) {
+    return JOB_NO_CHKSUM;
+  } else if (!chksumfile_compare(chksum, job->chksum)) {
+    return JOB_MISMATCH;
+  }
+  return JOB_OK;
+}
+
+static void *PathWorker(void *arg) {
+  struct pathwalk *walk = arg;
+  pthread_mutex_lock(&walk->lock);
+  while (1) {
+    while (walk->numClaimed == walk->numAdded && !walk->walkDone) {
+      pthread_cond_wait(&walk->jobAdded, &walk->lock);
+    }
+    if (walk->numClaimed == walk->numAdded) break;
+    // Jobs that were ready when added (directories) can be printed, and
+    // their slots reused, before a thread gets to them; skip past them, so
+    // the index claimed is always the job in that slot.
+    if (walk->numClaimed < walk->numPrinted) {
+      walk->numClaimed = walk->numPrinted;
       continue;
     }
+    struct pathjob *job = &walk->jobs[walk->numClaimed++ % kPathWindow];
+    if (job->ready) continue;
+    pthread_mutex_unlock(&walk->lock);
+    enum jobstatus status = ChecksumPath(walk->fs, job);
+    pthread_mutex_lock(&walk->lock);
+    job->status = status;
+    job->ready = 1;
+    pthread_cond_broadcast(&walk->jobReady);
+  }
+  pthread_mutex_unlock(&walk->lock);
+  return NULL;
+}
 
-    char chksum[CHKSUMFILE_SIZE];
-    if (chksumfile_byinumber(fs, inumber, chksum) < 0) {
-      fprintf(stderr, "Inode %d can't compute chksum\n", inumber);
+/**
+ * Prints the oldest unprinted jobs for as long as they're ready, waiting for
+ * the oldest to be if wait is set.  Called, and returns, with the lock held.
+ */
+static void PrintReadyPaths(struct pathwalk *walk, int wait) {
+  while (walk->numPrinted < walk->numAdded) {
+    struct pathjob *job = &walk->jobs[walk->numPrinted % kPathWindow];
+    if (!job->ready) {
+      if (!wait) return;
+      pthread_cond_wait(&walk->jobReady, &walk->lock);
       continue;
     }
+    // Nothing else touches a job that's ready until it's been printed.
+    pthread_mutex_unlock(&walk->lock);
+    if (job->status == JOB_NO_CHKSUM) {
+      fprintf(stderr,"Can't checksum inode %d path %s\n", job->inumber, job->pathname);
+    } else if (job->status == JOB_MISMATCH) {
+      fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", job->pathname, job->inumber);
+    } else {
+      char chksumstring[CHKSUMFILE_STRINGSIZE];
+      chksumfile_cvt2string(job->chksum, chksumstring);
+      int size = inode_getsize(&job->in);
+      fprintf(walk->out, "Path %s %d mode 0x%x size %d checksum %s\n", job->pathname, job->inumber, job->in.i_mode, size, chksumstring);
+    }
+    free(job->pathname);
+    pthread_mutex_lock(&walk->lock);
+    walk->numPrinted++;
+  }
+}
 
-    char chksumstring[CHKSUMFILE_STRINGSIZE];
-    chksumfile_cvt2string(chksum, chksumstring);
+/**
+ * Adds a job to the ring, printing whatever's ready first if there's no
+ * room for it.  Without any threads to leave it to, a file is checksummed
+ * right here.  Returns the job as it sits in the ring.
+ */
+static struct pathjob *AddPath(struct pathwalk *walk, const struct pathjob *job) {
+  struct pathjob added = *job;
+  if (!added.ready && walk->numWorkers == 0) {
+    added.status = ChecksumPath(walk->fs, &added);
+    added.ready = 1;
+  }
 
-    int size = inode_getsize(&in);
-    fprintf(f, "Inode %d mode 0x%x size %d checksum %s\n",inumber,in.i_mode, size, chksumstring);
+  pthread_mutex_lock(&walk->lock);
+  while (walk->numAdded - walk->numPrinted == kPathWindow) PrintReadyPaths(walk, 1);
+  struct pathjob *slot = &walk->jobs[walk->numAdded++ % kPathWindow];
+  *slot = added;
+  pthread_cond_signal(&walk->jobAdded);
+  PrintReadyPaths(walk, 0);
+  pthread_mutex_unlock(&walk->lock);
+  return slot;
+}
+
+/**
+ * Reads the whole of the directory with the specified inumber, checksums
+ * it, and hands back its contents (to be freed by the caller) in *data.
+ * Returns the size of the directory, or -1 if it can't be checksummed.
+ */
+static int ReadDirectory(struct unixfilesystem *fs, struct pathjob *job, char **data) {
+  *data = NULL;
+  struct file *f = file_open(fs, job->inumber);
+  if (f == NULL) return -1;
+  int size = f->size;
+  *data = malloc(size > 0 ? size : 1);
+  if (*data == NULL || file_read(f, 0, *data, size) != size ||
+      chksumfile_bydata(*data, size, job->chksum) < 0) {
+    file_close(f);
+    return -1;
   }
+  file_close(f);
+  return size;
 }
 
 /**
- * Output to the specified file the checksum of the specified pathname and
- * inode as well as all its children if it is a directory.
- *
- * This is used by the grading script, so be careful not to change its output
- * format.
+ * Finds what each entry of a directory resolves to by name, the way
+ * pathname_lookup would resolve its pathname.  Names pathname_lookup might
+ * take apart differently are left to it.
  */
-static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname, int inumber, FILE *f) {
-  struct inode in;
-  if (inode_iget(fs, inumber, &in) < 0) {
+static int ResolveEntry(struct unixfilesystem *fs, int dirResolved, const struct direntv6 *entry,
+                        const char *pathname) {
+  int length = strnlen(entry->d_name, sizeof(entry->d_name));
+  if (dirResolved < 0) return -1;
+  if (length == 0 || memchr(entry->d_name, '/', length) != NULL) return pathname_lookup(fs, pathname);
+
+  char name[sizeof(entry->d_name) + 1];
+  memcpy(name, entry->d_name, length);
+  name[length] = 0;
+  struct direntv6 found;
+  if (directory_findname(fs, name, dirResolved, &found) < 0) return -1;
+  return found.d_inumber;
+}
+
+/**
+ * Adds the specified pathname and, if it's a directory, everything beneath
+ * it, in the order they should be printed.  Each directory is read just
+ * once, both to checksum it and to find what's in it.
+ */
+static void WalkPathAndChildren(struct pathwalk *walk, const char *pathname, int inumber, int resolved) {
+  struct unixfilesystem *fs = walk->fs;
+  struct pathjob job = { NULL, inumber, resolved, { 0 }, 0, JOB_OK, { 0 } };
+  if (inode_iget(fs, inumber, &job.in) < 0) {
     fprintf(stderr,"Can't read inode %d \n", inumber);
     return;
   }
-  assert(in.i_mode & IALLOC);
+  assert(job.in.i_mode & IALLOC);
+  job.pathname = strdup(pathname);
 
-  char chksum1[CHKSUMFILE_SIZE];
-  if (chksumfile_byinumber(fs, inumber, chksum1) < 0) {
-    fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
+  if ((job.in.i_mode & IFMT) != IFDIR) {
+    AddPath(walk, &job);
     return;
   }
 
-  char chksum2[CHKSUMFILE_SIZE];
-  if (chksumfile_bypathname(fs, pathname, chksum2) < 0) {
-    fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
-    return;
+  // Only a directory that checksums cleanly is worth walking.
+  char *data;
+  int size = ReadDirectory(fs, &job, &data);
+  char chksum[CHKSUMFILE_SIZE];
+  if (size < 0 || resolved < 0 ||
+      (resolved != inumber && chksumfile_byinumber(fs, resolved, chksum) < 0)) {
+    job.status = JOB_NO_CHKSUM;
+  } else if (resolved != inumber && !chksumfile_compare(chksum, job.chksum)) {
+    job.status = JOB_MISMATCH;
   }
-
-  if (!chksumfile_compare(chksum1, chksum2)) {
-    fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", pathname, inumber);
+  job.ready = 1;
+  AddPath(walk, &job);
+  if (job.status != JOB_OK) {
+    free(data);
     return;
   }
 
-  char chksumstring[CHKSUMFILE_STRINGSIZE];
-  chksumfile_cvt2string(chksum2, chksumstring);
-  int size = inode_getsize(&in);
-  fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n", pathname, inumber, in.i_mode, size, chksumstring);
-
   if (pathname[1] == 0) {
     /* pathame == "/" */
     pathname++; /* Delete extra / character */
   }
 
-  if ((in.i_mode & IFMT) == IFDIR) { 
-      const unsigned int MAXPATH = 1024;
-      if (strlen(pathname) > MAXPATH-16) {
-        fprintf(stderr, "Too deep of directories %s\n", pathname);
-      }
+  const unsigned int MAXPATH = 1024;
+  if (strlen(pathname) > MAXPATH-16) {
+    fprintf(stderr, "Too deep of directories %s\n", pathname);
+  }
 
-      struct direntv6 direntries[10000];
-      int numentries = GetDirEntries(fs, inumber, direntries, 10000);
-      for (int i = 0; i < numentries; i++) {
-        char *n =  direntries[i].d_name;
-        if (n[0] == '.') {
-          if ((n[1] == 0) || ((n[1] == '.') && (n[2] == 0))) {
-            /* Skip over "." and ".." */
-            continue;
-          }
-        }
-
-        char nextpath[MAXPATH];
-        sprintf(nextpath, "%s/%s", pathname, direntries[i].d_name);
-        DumpPathAndChildren(fs, nextpath,  direntries[i].d_inumber, f);
+  assert((size % sizeof(struct direntv6)) == 0);
+  const struct direntv6 *direntries = (const struct direntv6 *) data;
+  int numentries = size / sizeof(struct direntv6);
+  if (numentries > 10000) numentries = 10000;
+  directory_remember(fs, inumber, direntries, size / sizeof(struct direntv6));
+  for (int i = 0; i < numentries; i++) {
+    const char *n =  direntries[i].d_name;
+    if (n[0] == '.') {
+      if ((n[1] == 0) || ((n[1] == '.') && (n[2] == 0))) {
+        /* Skip over "." and ".." */
+        continue;
       }
+    }
+
+    char nextpath[MAXPATH];
+    snprintf(nextpath, MAXPATH, "%s/%.*s", pathname, (int) sizeof(direntries[i].d_name), n);
+    int childResolved = ResolveEntry(fs, resolved, &direntries[i], nextpath);
+    WalkPathAndChildren(walk, nextpath, direntries[i].d_inumber, childResolved);
   }
+  free(data);
 }
 
 /**
  * Output to the specified file the checksum of files on the disk by
- * tranversing the naming hierarcy. 
+ * tranversing the naming hierarcy.  The hierarchy is walked once, and the
+ * files it turns up are checksummed by numThreads threads as the walk goes
+ * on, each file's data read and hashed just once.  Paths are printed in the
+ * order the walk finds them, as soon as everything before them is done.
  * Note this is used by the grading script so don't alter output format. 
  */
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f) {
-  DumpPathAndChildren(fs, "/", ROOT_INUMBER, f);
+  struct pathwalk *walk = calloc(1, sizeof(struct pathwalk));
+  if (walk == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return;
+  }
+  walk->fs = fs;
+  walk->out = f;
+  pthread_mutex_init(&walk->lock, NULL);
+  pthread_cond_init(&walk->jobAdded, NULL);
+  pthread_cond_init(&walk->jobReady, NULL);
+  pthread_t workers[numThreads];
+  while (numThreads > 1 && walk->numWorkers < numThreads &&
+         pthread_create(&workers[walk->numWorkers], NULL, PathWorker, walk) == 0) {
+    walk->numWorkers++;
+  }
+
+  WalkPathAndChildren(walk, "/", ROOT_INUMBER, ROOT_INUMBER);
+
+  pthread_mutex_lock(&walk->lock);
+  walk->walkDone = 1;
+  pthread_cond_broadcast(&walk->jobAdded);
+  PrintReadyPaths(walk, 1);
+  pthread_mutex_unlock(&walk->lock);
+  for (int t = 0; t < walk->numWorkers; t++) pthread_join(workers[t], NULL);
+  pthread_mutex_destroy(&walk->lock);
+  pthread_cond_destroy(&walk->jobAdded);
+  pthread_cond_destroy(&walk->jobReady);
+  free(walk);
 }
 
 /**
@@ -255,6 +666,19 @@ static int GetDirEntries(struct unixfilesystem *fs, int inumber, struct direntv6
   return count;
 }
 
+/**
+ * Report how the sector cache did on stderr, so that the checksum output
+ * the grading script looks at is left alone.  It's extra info, so -q
+ * leaves it out unless -s asked for the statistics.
+ */
+static void PrintCacheStats(int fd) {
+  struct diskimg_stats stats;
+  if (diskimg_getstats(fd, &stats) < 0 || stats.cacheSectors == 0) return;
+  unsigned long reads = stats.hits + stats.misses;
+  fprintf(stderr, "Sector cache (%d sectors): %lu reads, %lu hits (%.1f%%), %lu misses, %lu evictions\n",
+          stats.cacheSectors, reads, stats.hits, reads > 0 ? 100.0 * stats.hits / reads : 0.0,
+          stats.misses, stats.evictions);
+}
 
 static void PrintUsageAndExit(char *progname) {
   fprintf(stderr, "Usage: %s <options> diskimagePath\n", progname);
@@ -262,5 +686,11 @@ static void PrintUsageAndExit(char *progname) {
   fprintf(stderr, "-q     don't print extra info\n"); 
   fprintf(stderr, "-i     print all inode checksums\n"); 
   fprintf(stderr, "-p     print all pathname checksums\n");  
+  fprintf(stderr, "-m     map the whole image into memory instead of reading it\n");
+  fprintf(stderr, "-s     report I/O counts and latencies for each layer (on stderr)\n");
+  fprintf(stderr, "-j <n> checksum with n threads (output is the same)\n");
+  fprintf(stderr, "-a <n> with -i, keep up to n reads in flight per thread\n");
+  fprintf(stderr, "-k <f> keep file checksums in f, and only rehash files changed since\n");
+  fprintf(stderr, "-c <n> cache up to n sectors (default %d, 0 to disable)\n", DISKIMG_DEFAULT_CACHE_SECTORS);
   exit(EXIT_FAILURE);
 }
@@ -1,31 +1,523 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "diskimg.h"
+#include "fsstats.h"
+
+#define NO_SLOT -1
+#define MAX_WRITE_RUN 256   // most sectors written back with one call
+
+/**
+ * One cached sector.  Slots are linked into the LRU list (most recently used
+ * at the head) and into the chain of their hash bucket by index, so the whole
+ * cache is a single allocation of fixed size.
+ */
+struct cacheslot {
+  int sector;
+  int prev, next;     // neighbors in the LRU list
+  int hashnext;       // next slot in the same hash bucket
+  int dirty;          // written to the cache but not yet to the image
+  char data[DISKIMG_SECTOR_SIZE];
+};
+
+/**
+ * Everything the diskimg layer keeps about one open image.  Images are found
+ * by the file descriptor diskimg_open handed out.  Sectors are read with
+ * pread, so there's no shared file offset; lock guards the cache and its
+ * counters, so any number of threads can read the same image at once.
+ */
+struct diskimg {
+  int fd;
+  struct diskimg *next;
+
+  char *map;          // the whole image, read-only, for DISKIMG_MAPPED
+  size_t mapSize;
+
+  struct cacheslot *slots;
+  int *buckets;
+  int numSlots;       // capacity of the cache, 0 if caching is disabled
+  int numUsed;        // slots holding a sector, always the first numUsed
+  int numBuckets;     // a power of two
+  int head, tail;
+  int writeback;      // whether writes stop at the cache
+  int numDirty;
+  int writeError;     // whether writing back a dirty sector has failed
+  struct diskimg_stats stats;
+  pthread_mutex_t lock;
+};
+
+static struct diskimg *images = NULL;
+static pthread_mutex_t imagesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct diskimg *diskimg_find(int fd) {
+  pthread_mutex_lock(&imagesLock);
+  struct diskimg *img = images;
+  while (img != NULL && img->fd != fd) img = img->next;
+  pthread_mutex_unlock(&imagesLock);
+  return img;
+}
+
+static int *cache_bucket(struct diskimg *img, int sectorNum) {
+  return &img->buckets[(sectorNum * 2654435761u) & (img->numBuckets - 1)];
+}
+
+static int cache_lookup(struct diskimg *img, int sectorNum) {
+  if (img->numSlots == 0) return NO_SLOT;
+  int s = *cache_bucket(img, sectorNum);
+  while (s != NO_SLOT && img->slots[s].sector != sectorNum) s = img->slots[s].hashnext;
+  return s;
+}
+
+static void lru_unlink(struct diskimg *img, int s) {
+  struct cacheslot *slot = &img->slots[s];
+  if (slot->prev != NO_SLOT) img->slots[slot->prev].next = slot->next; else img->head = slot->next;
+  if (slot->next != NO_SLOT) img->slots[slot->next].prev = slot->prev; else img->tail = slot->prev;
+}
+
+static void lru_pushfront(struct diskimg *img, int s) {
+  struct cacheslot *slot = &img->slots[s];
+  slot->prev = NO_SLOT;
+  slot->next = img->head;
+  if (img->head != NO_SLOT) img->slots[img->head].prev = s; else img->tail = s;
+  img->head = s;
+}
+
+/**
+ * Writes count dirty slots, which hold consecutive sectors in order, to the
+ * image with a single call, and marks them clean.  The caller must hold
+ * img->lock.
+ */
+static void cache_writerun(struct diskimg *img, const int *slots, int count) {
+  struct iovec iov[count];
+  for (int i = 0; i < count; i++) {
+    iov[i].iov_base = img->slots[slots[i]].data;
+    iov[i].iov_len = DISKIMG_SECTOR_SIZE;
+  }
+  off_t offset = (off_t) img->slots[slots[0]].sector * DISKIMG_SECTOR_SIZE;
+  ssize_t n = pwritev(img->fd, iov, count, offset);
+  if (n != (ssize_t) count * DISKIMG_SECTOR_SIZE) img->writeError = 1;
+  img->stats.diskWrites++;
+  img->stats.sectorsWritten += count;
+  fsstats_count(FSSTATS_SECTOR_WRITES, 1);
+  fsstats_count(FSSTATS_SECTORS_WRITTEN, count);
+  for (int i = 0; i < count; i++) img->slots[slots[i]].dirty = 0;
+  img->numDirty -= count;
+}
+
+/**
+ * A dirty slot, sorted by the sector it holds.
+ */
+struct dirtyslot {
+  int sector;
+  int slot;
+};
+
+static int compare_dirtyslots(const void *a, const void *b) {
+  int sa = ((const struct dirtyslot *) a)->sector, sb = ((const struct dirtyslot *) b)->sector;
+  return (sa > sb) - (sa < sb);
+}
+
+/**
+ * Writes every dirty sector to the image, in order, a run of consecutive
+ * sectors at a time.  The caller must hold img->lock.
+ */
+static void cache_writeall(struct diskimg *img) {
+  if (img->numDirty == 0) return;
+  struct dirtyslot *dirty = malloc(img->numDirty * sizeof(struct dirtyslot));
+  int numDirty = 0;
+  for (int s = 0; s < img->numUsed; s++) {
+    if (!img->slots[s].dirty) continue;
+    if (dirty == NULL) {
+      cache_writerun(img, &s, 1);   // no memory to sort them, so one at a time
+    } else {
+      dirty[numDirty].sector = img->slots[s].sector;
+      dirty[numDirty++].slot = s;
+    }
+  }
+  if (dirty != NULL) {
+    qsort(dirty, numDirty, sizeof(struct dirtyslot), compare_dirtyslots);
+    int run[MAX_WRITE_RUN];
+    int runLength = 0;
+    for (int i = 0; i < numDirty; i++) {
+      if (runLength == MAX_WRITE_RUN ||
+          (runLength > 0 && dirty[i].sector != dirty[i - 1].sector + 1)) {
+        cache_writerun(img, run, runLength);
+        runLength = 0;
+      }
+      run[runLength++] = dirty[i].slot;
+    }
+    if (runLength > 0) cache_writerun(img, run, runLength);
+    free(dirty);
+  }
+}
+
+/**
+ * Writes every dirty sector, as cache_writeall does.  Returns 0 on success
+ * and -1 if any write (including one made on eviction) has failed.
+ */
+static int cache_writeback(struct diskimg *img) {
+  cache_writeall(img);
+  int err = img->writeError ? -1 : 0;
+  img->writeError = 0;
+  return err;
+}
+
+/**
+ * Finds a slot to hold sectorNum, evicting the least recently used sector if
+ * the cache is full, and links it in as the most recently used.  The caller
+ * fills in the data.  If the sector evicted is dirty, it's likely most of
+ * the cache is, so everything dirty is written then, in as few runs as
+ * possible, rather than a sector at a time as each is evicted.
+ */
+static int cache_claim(struct diskimg *img, int sectorNum) {
+  int s;
+  if (img->numUsed < img->numSlots) {
+    s = img->numUsed++;
+  } else {
+    s = img->tail;
+    if (img->slots[s].dirty) cache_writeall(img);
+    lru_unlink(img, s);
+    int *link = cache_bucket(img, img->slots[s].sector);
+    while (*link != s) link = &img->slots[*link].hashnext;
+    *link = img->slots[s].hashnext;
+    img->stats.evictions++;
+  }
+  int *bucket = cache_bucket(img, sectorNum);
+  img->slots[s].sector = sectorNum;
+  img->slots[s].dirty = 0;
+  img->slots[s].hashnext = *bucket;
+  *bucket = s;
+  lru_pushfront(img, s);
+  return s;
+}
+
+static void cache_free(struct diskimg *img) {
+  free(img->slots);
+  free(img->buckets);
+  img->slots = NULL;
+  img->buckets = NULL;
+  img->numSlots = img->numUsed = img->numBuckets = 0;
+  img->head = img->tail = NO_SLOT;
+}
 
 int diskimg_open(char *pathname, int readOnly) {
-  return open(pathname, readOnly ? O_RDONLY : O_RDWR);
+  return diskimg_openbackend(pathname, readOnly, DISKIMG_BUFFERED);
+}
+
+/**
+ * Gives the cache room for numSectors sectors, throwing away whatever it
+ * held once anything dirty has been written.  The caller must hold img->lock
+ * (or be the only one who can see img).
+ */
+static int cache_resize(struct diskimg *img, int numSectors) {
+  int err = cache_writeback(img);
+  cache_free(img);
+  if (numSectors == 0) {
+    img->writeback = 0;
+    return err;
+  }
+
+  int numBuckets = 1;
+  while (numBuckets < 2 * numSectors) numBuckets *= 2;
+  img->slots = malloc(numSectors * sizeof(struct cacheslot));
+  img->buckets = malloc(numBuckets * sizeof(int));
+  if (img->slots == NULL || img->buckets == NULL) {
+    cache_free(img);
+    return -1;
+  }
+  for (int b = 0; b < numBuckets; b++) img->buckets[b] = NO_SLOT;
+  img->numSlots = numSectors;
+  img->numBuckets = numBuckets;
+  return err;
+}
+
+static int diskimg_free(struct diskimg *img) {
+  int err = cache_writeback(img);
+  if (img->map != NULL) munmap(img->map, img->mapSize);
+  cache_free(img);
+  pthread_mutex_destroy(&img->lock);
+  free(img);
+  return err;
+}
+
+int diskimg_openbackend(char *pathname, int readOnly, enum diskimg_backend backend) {
+  if (backend == DISKIMG_MAPPED && !readOnly) return -1;
+  int fd = open(pathname, readOnly ? O_RDONLY : O_RDWR);
+  if (fd < 0) return fd;
+
+  struct diskimg *img = calloc(1, sizeof(struct diskimg));
+  if (img == NULL) {
+    close(fd);
+    return -1;
+  }
+  img->fd = fd;
+  img->head = img->tail = NO_SLOT;
+  pthread_mutex_init(&img->lock, NULL);
+
+  int err = 0;
+  if (backend == DISKIMG_MAPPED) {
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+      err = -1;
+    } else {
+      img->map = map;
+      img->mapSize = st.st_size;
+    }
+  } else {
+    err = cache_resize(img, DISKIMG_DEFAULT_CACHE_SECTORS);
+  }
+  if (err < 0) {
+    (void) diskimg_free(img);
+    close(fd);
+    return -1;
+  }
+
+  pthread_mutex_lock(&imagesLock);
+  img->next = images;
+  images = img;
+  pthread_mutex_unlock(&imagesLock);
+  return fd;
+}
+
+int diskimg_setcachesize(int fd, int numSectors) {
+  struct diskimg *img = diskimg_find(fd);
+  if (img == NULL || numSectors < 0) return -1;
+  if (img->map != NULL) return numSectors == 0 ? 0 : -1;  // the map is the cache
+
+  pthread_mutex_lock(&img->lock);
+  int err = cache_resize(img, numSectors);
+  pthread_mutex_unlock(&img->lock);
+  return err;
+}
+
+int diskimg_setwriteback(int fd, int on) {
+  struct diskimg *img = diskimg_find(fd);
+  if (img == NULL) return -1;
+  pthread_mutex_lock(&img->lock);
+  int err = 0;
+  if (on && img->numSlots == 0) {
+    err = -1;
+  } else if (!on) {
+    err = cache_writeback(img);
+  }
+  if (err == 0) img->writeback = on;
+  pthread_mutex_unlock(&img->lock);
+  return err;
+}
+
+int diskimg_flush(int fd) {
+  struct diskimg *img = diskimg_find(fd);
+  if (img == NULL) return -1;
+  pthread_mutex_lock(&img->lock);
+  int err = cache_writeback(img);
+  pthread_mutex_unlock(&img->lock);
+  return err;
+}
+
+int diskimg_getstats(int fd, struct diskimg_stats *stats) {
+  struct diskimg *img = diskimg_find(fd);
+  if (img == NULL) return -1;
+  pthread_mutex_lock(&img->lock);
+  *stats = img->stats;
+  stats->cacheSectors = img->numSlots;
+  stats->dirtySectors = img->numDirty;
+  pthread_mutex_unlock(&img->lock);
+  return 0;
 }
 
 int diskimg_getsize(int fd) {
-  return lseek(fd, 0, SEEK_END);
+  struct stat st;
+  if (fstat(fd, &st) < 0) return -1;
+  return st.st_size;
+}
+
+const void *diskimg_getsector(int fd, int sectorNum, void *buf) {
+  struct diskimg *img = diskimg_find(fd);
+  if (img != NULL && img->map != NULL) {
+    if (sectorNum < 0 || (size_t) (sectorNum + 1) * DISKIMG_SECTOR_SIZE > img->mapSize) return NULL;
+    fsstats_count(FSSTATS_MAPPED_SECTORS, 1);
+    return img->map + (size_t) sectorNum * DISKIMG_SECTOR_SIZE;
+  }
+  if (buf == NULL || diskimg_readsector(fd, sectorNum, buf) != DISKIMG_SECTOR_SIZE) return NULL;
+  return buf;
+}
+
+int diskimg_ismapped(int fd) {
+  struct diskimg *img = diskimg_find(fd);
+  return img != NULL && img->map != NULL;
+}
+
+static int readsector(int fd, int sectorNum, void *buf) {
+  if (sectorNum < 0) return -1;
+  struct diskimg *img = diskimg_find(fd);
+  if (img != NULL && img->map != NULL) {
+    size_t offset = (size_t) sectorNum * DISKIMG_SECTOR_SIZE;
+    if (offset >= img->mapSize) return 0;
+    size_t bytesRead = img->mapSize - offset < DISKIMG_SECTOR_SIZE ? img->mapSize - offset : DISKIMG_SECTOR_SIZE;
+    memcpy(buf, img->map + offset, bytesRead);
+    fsstats_count(FSSTATS_MAPPED_SECTORS, 1);
+    return bytesRead;
+  }
+
+  if (img != NULL) {
+    pthread_mutex_lock(&img->lock);
+    int s = cache_lookup(img, sectorNum);
+    if (s != NO_SLOT) {
+      img->stats.hits++;
+      lru_unlink(img, s);
+      lru_pushfront(img, s);
+      memcpy(buf, img->slots[s].data, DISKIMG_SECTOR_SIZE);
+    } else {
+      img->stats.misses++;
+    }
+    pthread_mutex_unlock(&img->lock);
+    if (s != NO_SLOT) {
+      fsstats_count(FSSTATS_SECTOR_CACHE_HITS, 1);
+      return DISKIMG_SECTOR_SIZE;
+    }
+  }
+
+  // The lock isn't held across the read, so that other threads' hits (and
+  // misses) aren't stuck behind it.
+  int bytesRead = pread(fd, buf, DISKIMG_SECTOR_SIZE, (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+  fsstats_count(FSSTATS_SECTOR_READS, 1);
+  fsstats_count(FSSTATS_SECTORS_READ, 1);
+
+  // Only whole sectors are worth remembering; a short read at the end of the
+  // image is passed through as is.
+  if (img != NULL) {
+    pthread_mutex_lock(&img->lock);
+    img->stats.diskReads++;
+    img->stats.diskBytes += DISKIMG_SECTOR_SIZE;
+    if (bytesRead == DISKIMG_SECTOR_SIZE && img->numSlots > 0 && cache_lookup(img, sectorNum) == NO_SLOT) {
+      int s = cache_claim(img, sectorNum);
+      memcpy(img->slots[s].data, buf, DISKIMG_SECTOR_SIZE);
+    }
+    pthread_mutex_unlock(&img->lock);
+  }
+  return bytesRead;
 }
 
 int diskimg_readsector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) return -1;  
-  return read(fd, buf, DISKIMG_SECTOR_SIZE);
+  struct fsstats_span span = fsstats_begin();
+  int bytesRead = readsector(fd, sectorNum, buf);
+  fsstats_end(FSSTATS_READSECTOR, span);
+  return bytesRead;
 }
 
-int diskimg_writesector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) {
-    return -1;
+static int readsectors(int fd, int firstSector, int numSectors, void *buf) {
+  if (firstSector < 0 || numSectors < 0) return -1;
+  size_t offset = (size_t) firstSector * DISKIMG_SECTOR_SIZE;
+  size_t length = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+  struct diskimg *img = diskimg_find(fd);
+  if (img != NULL && img->map != NULL) {
+    if (offset >= img->mapSize) return 0;
+    if (length > img->mapSize - offset) length = img->mapSize - offset;
+    memcpy(buf, img->map + offset, length);
+    fsstats_count(FSSTATS_MAPPED_SECTORS, length / DISKIMG_SECTOR_SIZE);
+    return length;
   }
 
-  return write(fd, buf, DISKIMG_SECTOR_SIZE);
+  // Anything cached is also on disk, unless it's dirty, so the cache can be
+  // skipped apart from any dirty sectors.  A read can come up short without
+  // being at the end of the image, so keep at it until it's done.
+  size_t bytesRead = 0;
+  int numReads = 0;
+  while (bytesRead < length) {
+    ssize_t n = pread(fd, (char *) buf + bytesRead, length - bytesRead, offset + bytesRead);
+    numReads++;
+    if (n < 0) return -1;
+    if (n == 0) break;
+    bytesRead += n;
+  }
+  fsstats_count(FSSTATS_SECTOR_READS, numReads);
+  fsstats_count(FSSTATS_SECTORS_READ, bytesRead / DISKIMG_SECTOR_SIZE);
+  if (img != NULL) {
+    pthread_mutex_lock(&img->lock);
+    img->stats.diskReads += numReads;
+    img->stats.diskBytes += length;
+    for (int i = 0; img->numDirty > 0 && i < numSectors; i++) {
+      int s = cache_lookup(img, firstSector + i);
+      if (s == NO_SLOT || !img->slots[s].dirty) continue;
+      size_t sectorOffset = (size_t) i * DISKIMG_SECTOR_SIZE;
+      // a dirty sector past the end of the image will be there once it's written
+      if (sectorOffset > bytesRead) memset((char *) buf + bytesRead, 0, sectorOffset - bytesRead);
+      memcpy((char *) buf + sectorOffset, img->slots[s].data, DISKIMG_SECTOR_SIZE);
+      if (sectorOffset + DISKIMG_SECTOR_SIZE > bytesRead) bytesRead = sectorOffset + DISKIMG_SECTOR_SIZE;
+    }
+    pthread_mutex_unlock(&img->lock);
+  }
+  return bytesRead;
+}
+
+int diskimg_readsectors(int fd, int firstSector, int numSectors, void *buf) {
+  struct fsstats_span span = fsstats_begin();
+  int bytesRead = readsectors(fd, firstSector, numSectors, buf);
+  fsstats_end(FSSTATS_READSECTORS, span);
+  return bytesRead;
+}
+
+int diskimg_writesector(int fd, int sectorNum,  void *buf) {
+  if (sectorNum < 0) return -1;
+  struct diskimg *img = diskimg_find(fd);
+  if (img != NULL) pthread_mutex_lock(&img->lock);
+  if (img != NULL && img->writeback) {
+    int s = cache_lookup(img, sectorNum);
+    if (s == NO_SLOT) {
+      s = cache_claim(img, sectorNum);
+    } else {
+      lru_unlink(img, s);
+      lru_pushfront(img, s);
+    }
+    memcpy(img->slots[s].data, buf, DISKIMG_SECTOR_SIZE);
+    if (!img->slots[s].dirty) img->numDirty++;
+    img->slots[s].dirty = 1;
+    pthread_mutex_unlock(&img->lock);
+    return DISKIMG_SECTOR_SIZE;
+  }
+  int bytesWritten = pwrite(fd, buf, DISKIMG_SECTOR_SIZE, (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+  fsstats_count(FSSTATS_SECTOR_WRITES, 1);
+  fsstats_count(FSSTATS_SECTORS_WRITTEN, 1);
+  if (img != NULL) {
+    img->stats.diskWrites++;
+    img->stats.sectorsWritten++;
+  }
+  int s = img != NULL ? cache_lookup(img, sectorNum) : NO_SLOT;
+  if (s != NO_SLOT) {
+    // The cache is write-through, so a cached copy just has to track the disk.
+    if (bytesWritten == DISKIMG_SECTOR_SIZE) {
+      memcpy(img->slots[s].data, buf, DISKIMG_SECTOR_SIZE);
+    } else {
+      // Who knows what made it to disk; start the cache over.
+      cache_resize(img, img->numSlots);
+    }
+  }
+  if (img != NULL) pthread_mutex_unlock(&img->lock);
+  return bytesWritten;
 }
 
 int diskimg_close(int fd) {
-  return close(fd);
+  struct diskimg *img = NULL;
+  pthread_mutex_lock(&imagesLock);
+  for (struct diskimg **link = &images; *link != NULL; link = &(*link)->next) {
+    if ((*link)->fd == fd) {
+      img = *link;
+      *link = img->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&imagesLock);
+  int err = img != NULL ? diskimg_free(img) : 0;
+  return close(fd) < 0 ? -1 : err;
 }
@@ -6,12 +6,82 @@
 // Size of a disk sector (e.g. block) in bytes.
 #define DISKIMG_SECTOR_SIZE 512
 
+// Number of sectors each open image caches unless told otherwise (256 KB).
+#define DISKIMG_DEFAULT_CACHE_SECTORS 512
+
+/**
+ * How well an image's sector cache has been doing since it was opened, and
+ * how much reading it has had to do.
+ */
+struct diskimg_stats {
+  unsigned long hits;       // reads answered from the cache
+  unsigned long misses;     // reads that went to the image
+  unsigned long evictions;  // sectors dropped to make room for others
+  unsigned long diskReads;  // read system calls issued, cached or not
+  unsigned long diskBytes;  // bytes those calls asked for
+  unsigned long diskWrites; // write system calls issued
+  unsigned long sectorsWritten;  // sectors those calls wrote
+  int cacheSectors;         // current capacity of the cache
+  int dirtySectors;         // sectors written to the cache but not the image yet
+};
+
+/**
+ * The ways an image can be read.  DISKIMG_BUFFERED reads each sector into
+ * the caller's buffer (through the sector cache below).  DISKIMG_MAPPED maps
+ * the whole image into memory, so that diskimg_getsector can hand out
+ * sectors without copying them; it's only available for read-only images.
+ */
+enum diskimg_backend {
+  DISKIMG_BUFFERED,
+  DISKIMG_MAPPED
+};
+
 /**
  * Opens a disk image for I/O. Returns an open file descriptor, or -1 if
  * unsuccessful.  
  */
 int diskimg_open(char *pathname, int readOnly);
 
+/**
+ * Same as diskimg_open, except that the image is read through the given
+ * backend.  diskimg_open is the same as asking for DISKIMG_BUFFERED.
+ */
+int diskimg_openbackend(char *pathname, int readOnly, enum diskimg_backend backend);
+
+/**
+ * Reads through an open image are cached in a bounded buffer of recently
+ * used sectors, evicting the least recently used sector when it fills up.
+ * This resizes that buffer to hold numSectors sectors, discarding whatever
+ * it held (once anything dirty is written); 0 turns caching off.  Mapped images don't cache, so asking one
+ * for a cache is an error.  Returns 0 on success, or -1 on error.
+ */
+int diskimg_setcachesize(int fd, int numSectors);
+
+/**
+ * Turns write-back caching on (or off) for an image with a sector cache.
+ * Ordinarily diskimg_writesector writes straight through to the image.  With
+ * write-back on, it just puts the sector in the cache, marked dirty, and the
+ * image is only written when a dirty sector is evicted or the cache is
+ * flushed, at which point runs of dirty sectors that sit next to each other
+ * are written with one system call each.  Reads see dirty sectors as they
+ * should.  Turning write-back off, resizing the cache and closing the image
+ * all flush it first.  Returns 0 on success, or -1 on error (including an
+ * image without a cache).
+ */
+int diskimg_setwriteback(int fd, int on);
+
+/**
+ * Writes every dirty sector in the cache to the image.  Returns 0 on success,
+ * or -1 if anything couldn't be written, now or when it was evicted earlier.
+ */
+int diskimg_flush(int fd);
+
+/**
+ * Copies the cache counters for an open image into stats.  Returns 0 on
+ * success, or -1 on error.
+ */
+int diskimg_getstats(int fd, struct diskimg_stats *stats);
+
 /**
  * Returns the size of the disk imgage in bytes, or -1 if unsuccessful.
  */
@@ -19,10 +89,35 @@ int diskimg_getsize(int fd);
 
 /**
  * Reads the specified sector (e.g. block) from the disk.  Returns the number of bytes read,
- * or -1 on error.
+ * or -1 on error.  Reads and writes don't depend on a shared file position, so
+ * several threads can use the same open image at once.
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Reads numSectors consecutive sectors, starting with firstSector, into buf
+ * with a single read.  These don't go through the sector cache.  Returns the
+ * number of bytes read, which is short only at the end of the image, or -1
+ * on error.
+ */
+int diskimg_readsectors(int fd, int firstSector, int numSectors, void *buf);
+
+/**
+ * Returns the specified sector for reading in place, or NULL on error (which
+ * includes a sector that runs past the end of the image).  For a mapped image
+ * this points into the mapping and buf isn't touched; otherwise the sector is
+ * read into buf, which must hold DISKIMG_SECTOR_SIZE bytes, and buf is
+ * returned.  Either way the pointer stays good until the image is closed or
+ * buf is reused.
+ */
+const void *diskimg_getsector(int fd, int sectorNum, void *buf);
+
+/**
+ * Returns 1 if fd was opened with DISKIMG_MAPPED and is being read through
+ * the mapping, and 0 otherwise.
+ */
+int diskimg_ismapped(int fd);
+
 /**
  * Writes the specified sector from the disk.  Returns the number of bytes
  * written, or -1 on error.
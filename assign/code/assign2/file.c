@@ -1,11 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "file.h"
 #include "inode.h"
 #include "diskimg.h"
+#include "directory.h"
+#include "pathname.h"
+#include "alloc.h"
+#include "fsstats.h"
 
-int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *buf) {
+#define FILE_PENDING_BLOCKS 64        // how much written data is held back, at most
+#define FILE_MAX_SIZE ((1 << 24) - 1)  // the size field is 24 bits
+
+static int getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *buf) {
     struct inode inp;
     if (inode_iget(fs, inumber, &inp) < 0) return -1;
     int block_add;
@@ -20,3 +30,307 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *bu
         return DISKIMG_SECTOR_SIZE;
     }
 }
+
+int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *buf) {
+    struct fsstats_span span = fsstats_begin();
+    int bytes = getblock(fs, inumber, blockNum, buf);
+    fsstats_end(FSSTATS_FILE_GETBLOCK, span);
+    return bytes;
+}
+
+struct file *file_open(struct unixfilesystem *fs, int inumber) {
+    struct file *f = malloc(sizeof(struct file));
+    if (f == NULL) return NULL;
+    f->fs = fs;
+    f->inumber = inumber;
+    f->blocks = NULL;
+    f->readahead = 0;
+    f->window = NULL;
+    f->windowFirst = f->windowCount = 0;
+    f->pending = NULL;
+    f->dirty = 0;
+    f->modified = 0;
+    if (inode_iget(fs, inumber, &f->in) < 0) {
+        free(f);
+        return NULL;
+    }
+    f->size = inode_getsize(&f->in);
+    f->numBlocks = (f->size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    if (f->numBlocks > 0) {
+        f->blocks = malloc(f->numBlocks * sizeof(int));
+        if (f->blocks == NULL || inode_getblockmap(fs, &f->in, f->blocks, f->numBlocks) < 0) {
+            free(f->blocks);
+            free(f);
+            return NULL;
+        }
+    }
+    f->numAllocated = f->blocksCapacity = f->numBlocks;
+    return f;
+}
+
+int file_setreadahead(struct file *f, int numBlocks) {
+    if (numBlocks < 0) return -1;
+    free(f->window);
+    f->window = NULL;
+    f->windowFirst = f->windowCount = 0;
+    f->readahead = 0;
+    if (numBlocks == 0) return 0;
+    if ((f->window = malloc(numBlocks * DISKIMG_SECTOR_SIZE)) == NULL) return -1;
+    f->readahead = numBlocks;
+    return 0;
+}
+
+/**
+ * Reads numBlocks whole file blocks, starting with blockNum, into buf.  Each
+ * run of blocks that sit next to each other on disk is fetched with a single
+ * read.  Returns 0 on success, -1 on error.
+ */
+static int file_readblocks(struct file *f, int blockNum, int numBlocks, char *buf) {
+    int done = 0;
+    while (done < numBlocks) {
+        int first = f->blocks[blockNum + done];
+        int run = 1;
+        while (done + run < numBlocks && f->blocks[blockNum + done + run] == first + run) run++;
+        int bytesRead = diskimg_readsectors(f->fs->dfd, first, run, buf + done * DISKIMG_SECTOR_SIZE);
+        if (bytesRead != run * DISKIMG_SECTOR_SIZE) return -1;
+        done += run;
+    }
+    return 0;
+}
+
+static int allocatepending(struct file *f);
+
+static int readfile(struct file *f, int offset, void *buf, int len) {
+    if (offset < 0 || len < 0) return -1;
+    if (f->numAllocated < f->numBlocks && allocatepending(f) < 0) return -1;
+    if (offset >= f->size) return 0;
+    if (len > f->size - offset) len = f->size - offset;
+
+    char *dst = buf;
+    int copied = 0;
+    while (copied < len) {
+        int pos = offset + copied;
+        int blockNum = pos / DISKIMG_SECTOR_SIZE;
+        int within = pos % DISKIMG_SECTOR_SIZE;
+        int chunk = DISKIMG_SECTOR_SIZE - within;
+        if (chunk > len - copied) chunk = len - copied;
+
+        if (blockNum >= f->windowFirst && blockNum < f->windowFirst + f->windowCount) {
+            memcpy(dst + copied, f->window + (blockNum - f->windowFirst) * DISKIMG_SECTOR_SIZE + within, chunk);
+            copied += chunk;
+            continue;
+        }
+
+        int wholeBlocks = within == 0 ? (len - copied) / DISKIMG_SECTOR_SIZE : 0;
+        if (wholeBlocks > 0 && wholeBlocks >= f->readahead) {
+            // at least a window's worth of whole blocks goes straight into the caller's buffer
+            if (file_readblocks(f, blockNum, wholeBlocks, dst + copied) < 0) return -1;
+            copied += wholeBlocks * DISKIMG_SECTOR_SIZE;
+        } else if (f->readahead > 0) {
+            // refill the window from here; the next time around copies out of it
+            int count = f->numBlocks - blockNum < f->readahead ? f->numBlocks - blockNum : f->readahead;
+            f->windowCount = 0;
+            if (file_readblocks(f, blockNum, count, f->window) < 0) return -1;
+            f->windowFirst = blockNum;
+            f->windowCount = count;
+        } else {
+            char sector[DISKIMG_SECTOR_SIZE];
+            const char *data = diskimg_getsector(f->fs->dfd, f->blocks[blockNum], sector);
+            if (data == NULL) return -1;
+            memcpy(dst + copied, data + within, chunk);
+            copied += chunk;
+        }
+    }
+    return copied;
+}
+
+int file_read(struct file *f, int offset, void *buf, int len) {
+    struct fsstats_span span = fsstats_begin();
+    int copied = readfile(f, offset, buf, len);
+    fsstats_end(FSSTATS_FILE_READ, span);
+    return copied;
+}
+
+/**
+ * Makes room for numBlocks entries in the file's block map.
+ */
+static int growblocks(struct file *f, int numBlocks) {
+    if (numBlocks <= f->blocksCapacity) return 0;
+    int capacity = f->blocksCapacity < 8 ? 8 : f->blocksCapacity;
+    while (capacity < numBlocks) capacity *= 2;
+    int *blocks = realloc(f->blocks, capacity * sizeof(int));
+    if (blocks == NULL) return -1;
+    f->blocks = blocks;
+    f->blocksCapacity = capacity;
+    return 0;
+}
+
+/**
+ * Gives every pending block of the file a disk block, in one go, and writes
+ * it there (zero-filling past the end of the file).
+ */
+static int allocatepending(struct file *f) {
+    int count = f->numBlocks - f->numAllocated;
+    if (count == 0) return 0;
+    if (growblocks(f, f->numBlocks) < 0 ||
+        alloc_blocks(f->fs, count, f->blocks + f->numAllocated) < 0) return -1;
+
+    int used = f->size - f->numAllocated * DISKIMG_SECTOR_SIZE;
+    memset(f->pending + used, 0, count * DISKIMG_SECTOR_SIZE - used);
+    for (int i = 0; i < count; i++) {
+        if (diskimg_writesector(f->fs->dfd, f->blocks[f->numAllocated + i],
+                                f->pending + i * DISKIMG_SECTOR_SIZE) != DISKIMG_SECTOR_SIZE) return -1;
+    }
+    f->numAllocated = f->numBlocks;
+    f->dirty = 1;
+    return 0;
+}
+
+/**
+ * Writes up to len bytes into a block that's already on disk, starting at
+ * byte pos of the file.  Returns the number of bytes written, or -1.
+ */
+static int writeblock(struct file *f, int pos, const char *buf, int len) {
+    int blockNum = pos / DISKIMG_SECTOR_SIZE;
+    int within = pos % DISKIMG_SECTOR_SIZE;
+    int chunk = DISKIMG_SECTOR_SIZE - within;
+    if (chunk > len) chunk = len;
+
+    char sector[DISKIMG_SECTOR_SIZE];
+    if (chunk < DISKIMG_SECTOR_SIZE &&
+        diskimg_readsector(f->fs->dfd, f->blocks[blockNum], sector) != DISKIMG_SECTOR_SIZE) return -1;
+    memcpy(sector + within, buf, chunk);
+    if (diskimg_writesector(f->fs->dfd, f->blocks[blockNum], sector) != DISKIMG_SECTOR_SIZE) return -1;
+    return chunk;
+}
+
+int file_write(struct file *f, int offset, const void *buf, int len) {
+    if (offset < 0 || len < 0 || offset > f->size || len > FILE_MAX_SIZE - offset) return -1;
+    f->windowCount = 0;   // whatever was read ahead may be out of date now
+
+    const char *src = buf;
+    int written = 0;
+    while (written < len) {
+        int pos = offset + written;
+        int chunk;
+        if (pos < f->numAllocated * DISKIMG_SECTOR_SIZE) {
+            chunk = writeblock(f, pos, src + written, len - written);
+        } else {
+            int pendingPos = pos - f->numAllocated * DISKIMG_SECTOR_SIZE;
+            if (pendingPos == FILE_PENDING_BLOCKS * DISKIMG_SECTOR_SIZE) {
+                chunk = allocatepending(f) < 0 ? -1 : 0;
+            } else {
+                if (f->pending == NULL && (f->pending = malloc(FILE_PENDING_BLOCKS * DISKIMG_SECTOR_SIZE)) == NULL) {
+                    return -1;
+                }
+                chunk = FILE_PENDING_BLOCKS * DISKIMG_SECTOR_SIZE - pendingPos;
+                if (chunk > len - written) chunk = len - written;
+                memcpy(f->pending + pendingPos, src + written, chunk);
+            }
+        }
+        if (chunk < 0) return -1;
+        written += chunk;
+        if (pos + chunk > f->size) {
+            f->size = pos + chunk;
+            f->numBlocks = (f->size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+            f->dirty = 1;
+        }
+    }
+    if (written > 0) f->modified = 1;
+    return written;
+}
+
+int file_append(struct file *f, const void *buf, int len) {
+    return file_write(f, f->size, buf, len);
+}
+
+int file_truncate(struct file *f, int size) {
+    if (size < 0 || size > FILE_MAX_SIZE) return -1;
+    char zeros[DISKIMG_SECTOR_SIZE];
+    memset(zeros, 0, sizeof(zeros));
+    while (f->size < size) {
+        int chunk = size - f->size < DISKIMG_SECTOR_SIZE ? size - f->size : DISKIMG_SECTOR_SIZE;
+        if (file_append(f, zeros, chunk) < 0) return -1;
+    }
+    if (f->size == size) return 0;
+
+    if (allocatepending(f) < 0) return -1;
+    f->windowCount = 0;
+    int numBlocks = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    if (alloc_freeblocks(f->fs, f->blocks + numBlocks, f->numBlocks - numBlocks) < 0) return -1;
+    f->size = size;
+    f->numBlocks = f->numAllocated = numBlocks;
+    f->dirty = 1;
+
+    // So that growing the file again later reads back zeros, not what was cut off.
+    int within = size % DISKIMG_SECTOR_SIZE;
+    if (within > 0 && writeblock(f, size, zeros, DISKIMG_SECTOR_SIZE - within) < 0) return -1;
+    return file_sync(f);
+}
+
+int file_sync(struct file *f) {
+    if (allocatepending(f) < 0) return -1;
+    if (!f->dirty && !f->modified) return 0;
+    if (f->dirty) {
+        if (inode_setblockmap(f->fs, &f->in, f->blocks, f->numBlocks) < 0) return -1;
+        inode_setsize(&f->in, f->size);
+    }
+    time_t now = time(NULL);
+    f->in.i_mtime[0] = now >> 16;
+    f->in.i_mtime[1] = now & 0xffff;
+    if (inode_iput(f->fs, f->inumber, &f->in) < 0) return -1;
+    f->dirty = 0;
+    f->modified = 0;
+    return 0;
+}
+
+int file_create(struct unixfilesystem *fs, const char *pathname, int mode) {
+    const char *slash = strrchr(pathname, '/');
+    if (pathname[0] != '/' || slash[1] == '\0' || strlen(slash + 1) > sizeof(((struct direntv6 *) 0)->d_name)) {
+        return -1;
+    }
+    char parent[slash - pathname + 2];
+    memcpy(parent, pathname, slash - pathname);
+    strcpy(parent + (slash - pathname), slash == pathname ? "/" : "");
+    int dirinumber = pathname_lookup(fs, parent);
+    if (dirinumber < 0) return -1;
+
+    // a new directory's ".." links to its parent, and i_nlink is one byte
+    int isDir = (mode & IFMT) == IFDIR;
+    struct inode parentIn;
+    if (isDir && (inode_iget(fs, dirinumber, &parentIn) < 0 || parentIn.i_nlink == UINT8_MAX)) return -1;
+
+    int inumber = alloc_inode(fs);
+    if (inumber < 0) return -1;
+    struct inode in;
+    memset(&in, 0, sizeof(in));
+    in.i_mode = IALLOC | (mode & ~(IALLOC | ILARG));
+    in.i_nlink = isDir ? 2 : 1;
+    time_t now = time(NULL);
+    in.i_atime[0] = in.i_mtime[0] = now >> 16;
+    in.i_atime[1] = in.i_mtime[1] = now & 0xffff;
+    if (inode_iput(fs, inumber, &in) < 0) return -1;
+
+    if (directory_addentry(fs, dirinumber, slash + 1, inumber) < 0) {
+        memset(&in, 0, sizeof(in));
+        (void) inode_iput(fs, inumber, &in);
+        alloc_freeinode(fs, inumber);
+        return -1;
+    }
+    if (isDir) {
+        if (directory_addentry(fs, inumber, ".", inumber) < 0 ||
+            directory_addentry(fs, inumber, "..", dirinumber) < 0 ||
+            inode_iget(fs, dirinumber, &parentIn) < 0) return -1;
+        parentIn.i_nlink++;
+        if (inode_iput(fs, dirinumber, &parentIn) < 0) return -1;
+    }
+    return inumber;
+}
+
+void file_close(struct file *f) {
+    if (f->dirty || f->modified || f->numAllocated < f->numBlocks) (void) file_sync(f);
+    free(f->pending);
+    free(f->window);
+    free(f->blocks);
+    free(f);
+}
@@ -9,4 +9,104 @@
  */
 int file_getblock(struct unixfilesystem *fs, int inumber, int blockNo, void *buf); 
 
+/**
+ * An open file, for reading a file through from start to finish.  The inode
+ * is fetched once, when the file is opened, and the disk block behind every
+ * file block is resolved then too, so reading costs one sector read per
+ * block rather than the inode and indirect block reads file_getblock repeats
+ * for every block.  Blocks that sit next to each other on disk are read
+ * together, with one read each run.
+ *
+ * A file can be written too.  Data written past the last block the file has
+ * on disk is held back, and only given blocks (all at once, from the free
+ * list) when enough of it has piled up, when it's read, or when the file is
+ * synced or closed.  Nothing written is on the disk image until the
+ * filesystem is flushed with unixfilesystem_flush, and file_getblock doesn't
+ * see it until the file is synced.  Writes have to come from one thread, with
+ * nothing else reading the filesystem at the time.
+ */
+struct file {
+  struct unixfilesystem *fs;
+  int inumber;
+  struct inode in;
+  int size;
+  int numBlocks;
+  int *blocks;    // disk block number of each file block
+
+  int readahead;    // size of the readahead window in blocks, 0 for none
+  char *window;     // the blocks most recently read ahead
+  int windowFirst;  // the first of them
+  int windowCount;  // and how many there are
+
+  int numAllocated;   // blocks with a disk block behind them; the rest are pending
+  int blocksCapacity; // room in blocks
+  char *pending;      // the pending blocks, which aren't on disk yet
+  int dirty;          // whether the block map and size have to be written back
+  int modified;       // whether the data has changed, so i_mtime has to be too
+};
+
+/**
+ * Opens the file with the specified inumber for reading.  Returns NULL on
+ * error.  The inode needn't be allocated; that's up to the caller to check.
+ */
+struct file *file_open(struct unixfilesystem *fs, int inumber);
+
+/**
+ * Copies up to len bytes of the file, starting at byte offset, into buf.
+ * Returns the number of bytes copied, which is only short of len at the end
+ * of the file, or -1 on error.
+ */
+int file_read(struct file *f, int offset, void *buf, int len);
+
+/**
+ * Turns on sequential readahead: a file_read that needs fewer than numBlocks
+ * whole blocks reads numBlocks of them into a window held by the file, and
+ * later reads are copied from that window for as long as they fall in it.
+ * That turns many small reads into a few large ones.  0 turns readahead off,
+ * which is how a file starts out.  Returns 0 on success, -1 on error.
+ */
+int file_setreadahead(struct file *f, int numBlocks);
+
+/**
+ * Copies len bytes from buf into the file, starting at byte offset, which
+ * can be anywhere up to the end of the file, growing it as needed.  Returns
+ * len, or -1 on error.
+ */
+int file_write(struct file *f, int offset, const void *buf, int len);
+
+/**
+ * Adds len bytes from buf to the end of the file.  Returns len, or -1 on
+ * error.
+ */
+int file_append(struct file *f, const void *buf, int len);
+
+/**
+ * Makes the file size bytes long, freeing the blocks it no longer needs or
+ * adding zeros.  Returns 0 on success, -1 on error.
+ */
+int file_truncate(struct file *f, int size);
+
+/**
+ * Gives any pending data its blocks and writes the file's block map and
+ * inode, if they've changed.  A file written since it was opened (or last
+ * synced), even in place, gets a new i_mtime.  Returns 0 on success, -1 on
+ * error.
+ */
+int file_sync(struct file *f);
+
+/**
+ * Makes a new, empty file at the specified absolute pathname, whose parent
+ * directory has to exist already and whose name doesn't, with the specified
+ * mode (IFDIR and permission bits; IALLOC is added).  A new directory gets
+ * "." and ".." entries, so fails if its parent already has the most links
+ * an inode can hold (255).  Returns the new inumber, or -1 on error.
+ */
+int file_create(struct unixfilesystem *fs, const char *pathname, int mode);
+
+/**
+ * Releases a file returned by file_open, syncing it first if it has been
+ * written (call file_sync beforehand to find out whether that works).
+ */
+void file_close(struct file *f);
+
 #endif // _FILE_H_
@@ -0,0 +1,122 @@
+#include <string.h>
+#include <time.h>
+
+#include "fsstats.h"
+
+#define NUM_BUCKETS 40   // bucket b holds latencies in [2^b, 2^(b+1)) nanoseconds
+
+struct opstats {
+  unsigned long calls;
+  unsigned long sectors;
+  unsigned long maxSectors;
+  uint64_t totalNanos;
+  unsigned long buckets[NUM_BUCKETS];
+};
+
+static int enabled = 0;
+static unsigned long counters[FSSTATS_NUM_COUNTERS];
+static struct opstats ops[FSSTATS_NUM_OPS];
+
+// Sectors the current thread has got from diskimg, so an operation can tell
+// what it cost.
+static __thread unsigned long threadSectors = 0;
+
+static const char *kCounterNames[FSSTATS_NUM_COUNTERS] = {
+  "diskimg read calls", "diskimg sectors read", "diskimg sector cache hits",
+  "diskimg mapped sectors", "diskimg write calls", "diskimg sectors written",
+  "inode cache hits", "inode indirect blocks read", "directory name cache hits",
+  "directory cache negatives", "directory scans", "pathname components",
+};
+
+static const char *kOpNames[FSSTATS_NUM_OPS] = {
+  "diskimg_readsector", "diskimg_readsectors", "inode_iget", "inode_indexlookup",
+  "file_getblock", "file_read", "directory_findname", "pathname_lookup",
+  "chksumfile_byinumber", "chksumfile_bypathname",
+};
+
+static uint64_t NowNanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void fsstats_enable(int on) {
+  if (on) {
+    memset(counters, 0, sizeof(counters));
+    memset(ops, 0, sizeof(ops));
+  }
+  __atomic_store_n(&enabled, on, __ATOMIC_RELEASE);
+}
+
+void fsstats_count(enum fsstats_counter counter, unsigned long n) {
+  if (counter == FSSTATS_SECTORS_READ || counter == FSSTATS_SECTOR_CACHE_HITS ||
+      counter == FSSTATS_MAPPED_SECTORS) {
+    threadSectors += n;
+  }
+  if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) return;
+  __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+struct fsstats_span fsstats_begin(void) {
+  struct fsstats_span span = { 0, threadSectors };
+  if (__atomic_load_n(&enabled, __ATOMIC_RELAXED)) span.start = NowNanos();
+  return span;
+}
+
+void fsstats_end(enum fsstats_op op, struct fsstats_span span) {
+  if (span.start == 0) return;
+  uint64_t nanos = NowNanos() - span.start;
+  unsigned long sectors = threadSectors - span.sectors;
+  int bucket = 0;
+  while (bucket < NUM_BUCKETS - 1 && (nanos >> (bucket + 1)) != 0) bucket++;
+
+  struct opstats *s = &ops[op];
+  __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->sectors, sectors, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->totalNanos, nanos, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->buckets[bucket], 1, __ATOMIC_RELAXED);
+  unsigned long max = __atomic_load_n(&s->maxSectors, __ATOMIC_RELAXED);
+  while (sectors > max &&
+         !__atomic_compare_exchange_n(&s->maxSectors, &max, sectors, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/**
+ * Returns the upper end (in microseconds) of the histogram bucket that holds
+ * the given fraction of an operation's calls.
+ */
+static double Percentile(const struct opstats *s, double fraction) {
+  unsigned long wanted = (unsigned long) (fraction * s->calls);
+  unsigned long seen = 0;
+  for (int b = 0; b < NUM_BUCKETS; b++) {
+    seen += s->buckets[b];
+    if (seen > wanted) return (double) ((uint64_t) 2 << b) / 1000;
+  }
+  return (double) ((uint64_t) 2 << (NUM_BUCKETS - 1)) / 1000;
+}
+
+void fsstats_report(FILE *f) {
+  fprintf(f, "Counters:\n");
+  for (int c = 0; c < FSSTATS_NUM_COUNTERS; c++) {
+    fprintf(f, "  %-28s %12lu\n", kCounterNames[c], counters[c]);
+  }
+
+  fprintf(f, "Operations:                       calls   mean us  p50 us<  p99 us<  sectors/call  max sectors\n");
+  for (int op = 0; op < FSSTATS_NUM_OPS; op++) {
+    const struct opstats *s = &ops[op];
+    if (s->calls == 0) continue;
+    fprintf(f, "  %-24s %12lu %9.2f %8.1f %8.1f %13.2f %12lu\n", kOpNames[op], s->calls,
+            (double) s->totalNanos / s->calls / 1000, Percentile(s, 0.5), Percentile(s, 0.99),
+            (double) s->sectors / s->calls, s->maxSectors);
+  }
+
+  fprintf(f, "Latency histograms (calls per power-of-two bucket, in us):\n");
+  for (int op = 0; op < FSSTATS_NUM_OPS; op++) {
+    const struct opstats *s = &ops[op];
+    if (s->calls == 0) continue;
+    fprintf(f, "  %s:", kOpNames[op]);
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+      if (s->buckets[b] != 0) fprintf(f, " <%g:%lu", (double) ((uint64_t) 2 << b) / 1000, s->buckets[b]);
+    }
+    fprintf(f, "\n");
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef _FSSTATS_H_
+#define _FSSTATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Instrumentation for the filesystem layers: event counters, plus a latency
+ * histogram and a count of the sectors read for each kind of operation.  It
+ * all starts out off, so nothing is recorded (or timed) until
+ * fsstats_enable is called.  Everything here may be used from any thread.
+ */
+
+/**
+ * Things that are counted.  Each layer counts its own.
+ */
+enum fsstats_counter {
+  FSSTATS_SECTOR_READS,       // diskimg: read system calls
+  FSSTATS_SECTORS_READ,       // diskimg: sectors those calls fetched
+  FSSTATS_SECTOR_CACHE_HITS,  // diskimg: sectors found in the sector cache
+  FSSTATS_MAPPED_SECTORS,     // diskimg: sectors taken from a mapped image
+  FSSTATS_SECTOR_WRITES,      // diskimg: write system calls
+  FSSTATS_SECTORS_WRITTEN,    // diskimg: sectors those calls wrote
+  FSSTATS_INODE_CACHE_HITS,   // inode: inodes found in the inode cache
+  FSSTATS_INDIRECT_READS,     // inode: indirect and doubly indirect blocks read
+  FSSTATS_DCACHE_HITS,        // directory: names found in the name cache
+  FSSTATS_DCACHE_NEGATIVES,   // directory: names the name cache knows are missing
+  FSSTATS_DIRECTORY_SCANS,    // directory: directories searched on disk
+  FSSTATS_PATH_COMPONENTS,    // pathname: names looked up along paths
+  FSSTATS_NUM_COUNTERS
+};
+
+/**
+ * Operations that are timed, and whose sector reads are tallied.
+ */
+enum fsstats_op {
+  FSSTATS_READSECTOR,         // diskimg_readsector
+  FSSTATS_READSECTORS,        // diskimg_readsectors
+  FSSTATS_INODE_IGET,         // inode_iget
+  FSSTATS_INODE_INDEXLOOKUP,  // inode_indexlookup
+  FSSTATS_FILE_GETBLOCK,      // file_getblock
+  FSSTATS_FILE_READ,          // file_read
+  FSSTATS_FINDNAME,           // directory_findname
+  FSSTATS_PATHNAME_LOOKUP,    // pathname_lookup
+  FSSTATS_CHKSUM_INUMBER,     // chksumfile_byinumber
+  FSSTATS_CHKSUM_PATHNAME,    // chksumfile_bypathname
+  FSSTATS_NUM_OPS
+};
+
+/**
+ * Where an operation started: when, and how many sectors the calling thread
+ * had read by then.  start is 0 if instrumentation is off.
+ */
+struct fsstats_span {
+  uint64_t start;
+  unsigned long sectors;
+};
+
+/**
+ * Turns recording on (or off again).  Turning it on also clears everything
+ * recorded so far.
+ */
+void fsstats_enable(int on);
+
+/**
+ * Adds n to the specified counter.
+ */
+void fsstats_count(enum fsstats_counter counter, unsigned long n);
+
+/**
+ * Brackets one operation.  fsstats_end records how long it took and how
+ * many sectors the calling thread got from diskimg in the meantime, whether
+ * they came from disk, the sector cache or a mapping (including those of any
+ * operations nested inside it).
+ */
+struct fsstats_span fsstats_begin(void);
+void fsstats_end(enum fsstats_op op, struct fsstats_span span);
+
+/**
+ * Prints everything recorded so far to f.
+ */
+void fsstats_report(FILE *f);
+
+#endif // _FSSTATS_H_
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+#include "directory.h"
+#include "alloc.h"
+
+/**
+ * Makes a disk image to benchmark with, of whatever size and shape is asked
+ * for, using the filesystem's own write path: an empty filesystem first, and
+ * then, each under a directory of its own at the root,
+ *
+ *   /small   many small files, spread over subdirectories of FILES_PER_DIR
+ *   /huge    a few huge files, big enough to need the doubly indirect block
+ *   /deep    a chain of nested directories with a file in each
+ *   /wide    one directory with very many files in it
+ *
+ * File contents come from a pseudorandom generator seeded with -r, so the
+ * same options always make the same files (though not the same timestamps).
+ */
+
+#define INODES_PER_SECTOR (DISKIMG_SECTOR_SIZE / sizeof(struct inode))
+#define MAX_BLOCKS 65535          // s_fsize is 16 bits
+#define MAX_INODES 65535          // and so is d_inumber
+#define MAX_FILE_SIZE 0xffffff    // and the size 24
+#define FILES_PER_DIR 64          // files in each subdirectory of /small
+#define WRITE_CHUNK (64 * DISKIMG_SECTOR_SIZE)
+
+struct shape {
+  int numBlocks;
+  int numInodes;
+  int numSmall;
+  int smallMax;     // sizes of small files are spread evenly over [0, smallMax]
+  int numHuge;
+  int hugeSize;
+  int depth;
+  int width;
+  uint64_t seed;
+};
+
+static uint64_t NextRandom(uint64_t *state) {
+  // xorshift64*
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+/**
+ * Makes the empty filesystem: boot block, superblock, a free list holding
+ * every data block, and a root directory.  Returns NULL on error.
+ */
+static struct unixfilesystem *MakeFilesystem(int fd, const struct shape *s) {
+  uint16_t sector[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+  memset(sector, 0, sizeof(sector));
+  sector[0] = BOOTBLOCK_MAGIC_NUM;
+  if (diskimg_writesector(fd, BOOTBLOCK_SECTOR, sector) != DISKIMG_SECTOR_SIZE) return NULL;
+
+  struct filsys sb;
+  memset(&sb, 0, sizeof(sb));
+  sb.s_isize = (s->numInodes + INODES_PER_SECTOR - 1) / INODES_PER_SECTOR;
+  sb.s_fsize = s->numBlocks;
+  if (diskimg_writesector(fd, SUPERBLOCK_SECTOR, &sb) != DISKIMG_SECTOR_SIZE) return NULL;
+
+  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  if (fs == NULL) return NULL;
+  int firstDataBlock = INODE_START_SECTOR + sb.s_isize;
+  int numData = s->numBlocks - firstDataBlock;
+  int *blocks = malloc(numData * sizeof(int));
+  if (blocks == NULL) {
+    unixfilesystem_free(fs);
+    return NULL;
+  }
+  for (int i = 0; i < numData; i++) blocks[i] = firstDataBlock + i;
+  int err = alloc_freeblocks(fs, blocks, numData);
+  free(blocks);
+
+  struct inode root;
+  memset(&root, 0, sizeof(root));
+  root.i_mode = IALLOC | IFDIR | 0755;
+  root.i_nlink = 2;
+  time_t now = time(NULL);
+  root.i_atime[0] = root.i_mtime[0] = now >> 16;
+  root.i_atime[1] = root.i_mtime[1] = now & 0xffff;
+  if (err < 0 || inode_iput(fs, ROOT_INUMBER, &root) < 0 ||
+      directory_addentry(fs, ROOT_INUMBER, ".", ROOT_INUMBER) < 0 ||
+      directory_addentry(fs, ROOT_INUMBER, "..", ROOT_INUMBER) < 0) {
+    unixfilesystem_free(fs);
+    return NULL;
+  }
+  return fs;
+}
+
+/**
+ * Makes a file of the specified size at pathname, filled with pseudorandom
+ * bytes.  Returns 0 on success, -1 on error.
+ */
+static int MakeFile(struct unixfilesystem *fs, const char *pathname, int size, uint64_t *state) {
+  int inumber = file_create(fs, pathname, 0644);
+  if (inumber < 0) return -1;
+  struct file *f = file_open(fs, inumber);
+  if (f == NULL) return -1;
+  uint64_t buf[WRITE_CHUNK / sizeof(uint64_t)];
+  for (int offset = 0; offset < size; offset += WRITE_CHUNK) {
+    int len = size - offset < WRITE_CHUNK ? size - offset : WRITE_CHUNK;
+    for (int i = 0; i < (len + 7) / 8; i++) buf[i] = NextRandom(state);
+    if (file_append(f, buf, len) != len) {
+      file_close(f);
+      return -1;
+    }
+  }
+  int err = file_sync(f);
+  file_close(f);
+  return err;
+}
+
+static int MakeDirectory(struct unixfilesystem *fs, const char *pathname) {
+  return file_create(fs, pathname, IFDIR | 0755) < 0 ? -1 : 0;
+}
+
+static int MakeFiles(struct unixfilesystem *fs, const struct shape *s) {
+  uint64_t state = s->seed ? s->seed : 1;
+  char path[256];
+
+  if (s->numSmall > 0 && MakeDirectory(fs, "/small") < 0) return -1;
+  for (int i = 0; i < s->numSmall; i++) {
+    int dir = i / FILES_PER_DIR;
+    if (i % FILES_PER_DIR == 0) {
+      sprintf(path, "/small/d%d", dir);
+      if (MakeDirectory(fs, path) < 0) return -1;
+    }
+    sprintf(path, "/small/d%d/f%d", dir, i);
+    if (MakeFile(fs, path, NextRandom(&state) % (s->smallMax + 1), &state) < 0) return -1;
+  }
+
+  if (s->numHuge > 0 && MakeDirectory(fs, "/huge") < 0) return -1;
+  for (int i = 0; i < s->numHuge; i++) {
+    sprintf(path, "/huge/h%d", i);
+    if (MakeFile(fs, path, s->hugeSize, &state) < 0) return -1;
+  }
+
+  // every name along the chain is one character, to fit it all in path
+  if (s->depth > 0) strcpy(path, "/deep");
+  for (int i = 0; i < s->depth; i++) {
+    if (MakeDirectory(fs, path) < 0) return -1;
+    strcat(path, "/f");
+    if (MakeFile(fs, path, NextRandom(&state) % (s->smallMax + 1), &state) < 0) return -1;
+    strcpy(path + strlen(path) - 1, "d");
+  }
+
+  if (s->width > 0 && MakeDirectory(fs, "/wide") < 0) return -1;
+  for (int i = 0; i < s->width; i++) {
+    sprintf(path, "/wide/w%d", i);
+    if (MakeFile(fs, path, NextRandom(&state) % (s->smallMax + 1), &state) < 0) return -1;
+  }
+  return 0;
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s [options] diskimagePath\n", progname);
+  fprintf(stderr, "-b <n> blocks in the image, at most %d (default 65535)\n", MAX_BLOCKS);
+  fprintf(stderr, "-i <n> inodes, at most %d (default 4096)\n", MAX_INODES);
+  fprintf(stderr, "-n <n> small files (default 1000)\n");
+  fprintf(stderr, "-z <n> largest small file, in bytes (default 4096)\n");
+  fprintf(stderr, "-H <n> huge files (default 2)\n");
+  fprintf(stderr, "-Z <n> size of each huge file, in bytes (default 4194304)\n");
+  fprintf(stderr, "-d <n> depth of the chain of nested directories (default 0)\n");
+  fprintf(stderr, "-w <n> files in the wide directory (default 0)\n");
+  fprintf(stderr, "-r <n> seed for file contents (default 1)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  struct shape s = { 65535, 4096, 1000, 4096, 2, 4 << 20, 0, 0, 1 };
+  int opt;
+  while ((opt = getopt(argc, argv, "b:i:n:z:H:Z:d:w:r:")) != -1) {
+    switch (opt) {
+    case 'b': s.numBlocks = atoi(optarg); break;
+    case 'i': s.numInodes = atoi(optarg); break;
+    case 'n': s.numSmall = atoi(optarg); break;
+    case 'z': s.smallMax = atoi(optarg); break;
+    case 'H': s.numHuge = atoi(optarg); break;
+    case 'Z': s.hugeSize = atoi(optarg); break;
+    case 'd': s.depth = atoi(optarg); break;
+    case 'w': s.width = atoi(optarg); break;
+    case 'r': s.seed = strtoull(optarg, NULL, 0); break;
+    default: PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || s.numBlocks < 1 || s.numBlocks > MAX_BLOCKS || s.numInodes < 1 ||
+      s.numInodes > MAX_INODES || s.numSmall < 0 || s.smallMax < 0 || s.smallMax > MAX_FILE_SIZE ||
+      s.numHuge < 0 || s.hugeSize < 0 || s.hugeSize > MAX_FILE_SIZE || s.depth < 0 ||
+      s.depth > 100 || s.width < 0) {
+    PrintUsageAndExit(argv[0]);
+  }
+  int numInodeBlocks = (s.numInodes + INODES_PER_SECTOR - 1) / INODES_PER_SECTOR;
+  if (INODE_START_SECTOR + numInodeBlocks >= s.numBlocks) {
+    fprintf(stderr, "%d blocks isn't room for %d inodes\n", s.numBlocks, s.numInodes);
+    exit(EXIT_FAILURE);
+  }
+
+  char *diskpath = argv[optind];
+  int rawfd = open(diskpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (rawfd < 0 || ftruncate(rawfd, (off_t) s.numBlocks * DISKIMG_SECTOR_SIZE) < 0) {
+    fprintf(stderr, "Can't create %s\n", diskpath);
+    exit(EXIT_FAILURE);
+  }
+  close(rawfd);
+
+  int fd = diskimg_open(diskpath, 0);
+  if (fd < 0 || diskimg_setwriteback(fd, 1) < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    exit(EXIT_FAILURE);
+  }
+  struct unixfilesystem *fs = MakeFilesystem(fd, &s);
+  if (fs == NULL) {
+    fprintf(stderr, "Can't make a filesystem on %s\n", diskpath);
+    (void) diskimg_close(fd);
+    exit(EXIT_FAILURE);
+  }
+
+  int err = MakeFiles(fs, &s);
+  if (err < 0) fprintf(stderr, "Couldn't make all the files on %s\n", diskpath);
+  if (unixfilesystem_flush(fs) < 0) {
+    fprintf(stderr, "Error writing %s\n", diskpath);
+    err = -1;
+  }
+  unixfilesystem_free(fs);
+  if (diskimg_close(fd) < 0) err = -1;
+  exit(err < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -1,55 +1,352 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "inode.h"
 #include "diskimg.h"
+#include "fsstats.h"
+#include "alloc.h"
 
 #define INODE_SIZE 32  // size in bytes
 #define INODE_PER_BLOCK (DISKIMG_SECTOR_SIZE/INODE_SIZE)
 #define BLOCKS_PER_INDIR 256
 #define NUM_INDIR_BLOCKS 7
 #define TOTAL_BLOCKS_FROM_INDIR (BLOCKS_PER_INDIR * NUM_INDIR_BLOCKS)
+#define NUM_DIRECT_BLOCKS 8
+#define MAX_FILE_BLOCKS (TOTAL_BLOCKS_FROM_INDIR + BLOCKS_PER_INDIR * BLOCKS_PER_INDIR)
+// at most one indirect block per i_addr slot, plus what the doubly indirect one points to
+#define MAX_INDIR_BLOCKS (NUM_INDIR_BLOCKS + 1 + BLOCKS_PER_INDIR)
 
-int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+/**
+ * A copy of the inode region, filled in a sector (16 inodes) at a time as
+ * inodes are asked for, so each inode sector is read at most once.
+ */
+struct inodecache {
+    struct inode *inodes;     // numSectors * INODE_PER_BLOCK of them
+    unsigned char *loaded;    // whether each sector's inodes are there yet
+    int numSectors;
+    pthread_mutex_t lock;
+};
+
+struct inodecache *inode_createcache(struct unixfilesystem *fs) {
+    struct inodecache *ic = malloc(sizeof(struct inodecache));
+    if (ic == NULL) return NULL;
+    ic->numSectors = fs->superblock.s_isize;
+    ic->inodes = malloc((size_t) ic->numSectors * DISKIMG_SECTOR_SIZE);
+    ic->loaded = calloc(ic->numSectors > 0 ? ic->numSectors : 1, 1);
+    if (ic->inodes == NULL || ic->loaded == NULL) {
+        free(ic->inodes);
+        free(ic->loaded);
+        free(ic);
+        return NULL;
+    }
+    pthread_mutex_init(&ic->lock, NULL);
+    return ic;
+}
+
+void inode_freecache(struct inodecache *ic) {
+    if (ic == NULL) return;
+    free(ic->inodes);
+    free(ic->loaded);
+    pthread_mutex_destroy(&ic->lock);
+    free(ic);
+}
+
+/**
+ * Copies numSectors sectors of inodes, starting with the given sector of the
+ * inode region, into the cache, unless they're already there.
+ */
+static void inode_fillcache(struct inodecache *ic, int firstSector, int numSectors, const struct inode *inodes) {
+    pthread_mutex_lock(&ic->lock);
+    for (int i = 0; i < numSectors && firstSector + i < ic->numSectors; i++) {
+        if (ic->loaded[firstSector + i]) continue;
+        memcpy(&ic->inodes[(firstSector + i) * INODE_PER_BLOCK], &inodes[i * INODE_PER_BLOCK], DISKIMG_SECTOR_SIZE);
+        ic->loaded[firstSector + i] = 1;
+    }
+    pthread_mutex_unlock(&ic->lock);
+}
+
+static int iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
     int offset = (inumber - 1) / INODE_PER_BLOCK;
+    struct inodecache *ic = fs->icache;
+    int cacheable = ic != NULL && inumber >= 1 && offset < ic->numSectors;
+    if (cacheable) {
+        pthread_mutex_lock(&ic->lock);
+        int loaded = ic->loaded[offset];
+        if (loaded) *inp = ic->inodes[inumber - 1];
+        pthread_mutex_unlock(&ic->lock);
+        if (loaded) {
+            fsstats_count(FSSTATS_INODE_CACHE_HITS, 1);
+            return 0;
+        }
+    }
+
     struct inode buffer[INODE_PER_BLOCK];
-    int byteRead = diskimg_readsector(fs->dfd, INODE_START_SECTOR + offset, buffer);
-    if (byteRead != DISKIMG_SECTOR_SIZE) {
+    const struct inode *inodes = diskimg_getsector(fs->dfd, INODE_START_SECTOR + offset, buffer);
+    if (inodes == NULL) {
         fprintf(stderr, "Failed to get inode number %d.\n", inumber);
         return -1;
     }
-    *inp = buffer[(inumber - 1) % INODE_PER_BLOCK];
+    if (cacheable) inode_fillcache(ic, offset, 1, inodes);
+    *inp = inodes[(inumber - 1) % INODE_PER_BLOCK];
     return 0;
 }
 
-int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum) {
+int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+    struct fsstats_span span = fsstats_begin();
+    int err = iget(fs, inumber, inp);
+    fsstats_end(FSSTATS_INODE_IGET, span);
+    return err;
+}
+
+int inode_iput(struct unixfilesystem *fs, int inumber, const struct inode *inp) {
+    if (inumber < 1 || inumber > fs->superblock.s_isize * INODE_PER_BLOCK) return -1;
+    int offset = (inumber - 1) / INODE_PER_BLOCK;
+    struct inode inodes[INODE_PER_BLOCK];
+    if (diskimg_readsector(fs->dfd, INODE_START_SECTOR + offset, inodes) != DISKIMG_SECTOR_SIZE) return -1;
+    inodes[(inumber - 1) % INODE_PER_BLOCK] = *inp;
+    if (diskimg_writesector(fs->dfd, INODE_START_SECTOR + offset, inodes) != DISKIMG_SECTOR_SIZE) return -1;
+
+    struct inodecache *ic = fs->icache;
+    if (ic != NULL && offset < ic->numSectors) {
+        pthread_mutex_lock(&ic->lock);
+        memcpy(&ic->inodes[offset * INODE_PER_BLOCK], inodes, DISKIMG_SECTOR_SIZE);
+        ic->loaded[offset] = 1;
+        pthread_mutex_unlock(&ic->lock);
+    }
+    return 0;
+}
+
+/**
+ * Where a scan through the inode table has got to.  chunk holds the inodes
+ * from the sectors read most recently, the first of which is chunkFirst.
+ */
+struct inodescan {
+    struct unixfilesystem *fs;
+    int chunkSectors;       // how many sectors to read at a time
+    struct inode *chunk;
+    int chunkFirst;         // inumber of chunk[0]
+    int chunkCount;         // inodes in chunk
+    int next;               // inumber to look at next
+};
+
+struct inodescan *inode_scanbegin(struct unixfilesystem *fs, int chunkSectors) {
+    if (chunkSectors < 1) return NULL;
+    struct inodescan *scan = malloc(sizeof(struct inodescan));
+    if (scan == NULL) return NULL;
+    scan->chunk = malloc((size_t) chunkSectors * DISKIMG_SECTOR_SIZE);
+    if (scan->chunk == NULL) {
+        free(scan);
+        return NULL;
+    }
+    scan->fs = fs;
+    scan->chunkSectors = chunkSectors;
+    scan->chunkFirst = 1;
+    scan->chunkCount = 0;
+    scan->next = 1;
+    return scan;
+}
+
+int inode_scannext(struct inodescan *scan, struct inode *inp) {
+    int numInodes = scan->fs->superblock.s_isize * INODE_PER_BLOCK;
+    while (scan->next <= numInodes) {
+        if (scan->next >= scan->chunkFirst + scan->chunkCount) {
+            // read the next stretch of the inode region in one go
+            int firstSector = (scan->next - 1) / INODE_PER_BLOCK;
+            int numSectors = scan->fs->superblock.s_isize - firstSector;
+            if (numSectors > scan->chunkSectors) numSectors = scan->chunkSectors;
+            int bytesRead = diskimg_readsectors(scan->fs->dfd, INODE_START_SECTOR + firstSector, numSectors, scan->chunk);
+            if (bytesRead != numSectors * DISKIMG_SECTOR_SIZE) {
+                fprintf(stderr, "Failed to get inode number %d.\n", scan->next);
+                return -1;
+            }
+            if (scan->fs->icache != NULL) inode_fillcache(scan->fs->icache, firstSector, numSectors, scan->chunk);
+            scan->chunkFirst = firstSector * INODE_PER_BLOCK + 1;
+            scan->chunkCount = numSectors * INODE_PER_BLOCK;
+        }
+        int inumber = scan->next++;
+        const struct inode *in = &scan->chunk[inumber - scan->chunkFirst];
+        if (in->i_mode & IALLOC) {
+            *inp = *in;
+            return inumber;
+        }
+    }
+    return 0;
+}
+
+int inode_scanposition(struct inodescan *scan) {
+    return scan->next;
+}
+
+void inode_scanend(struct inodescan *scan) {
+    free(scan->chunk);
+    free(scan);
+}
+
+static int indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum) {
     if ((inp->i_mode & ILARG) == 0) {
         // inode using algorithm for small files
         return inp->i_addr[blockNum];
     }
     uint16_t buffer[BLOCKS_PER_INDIR];
+    const uint16_t *indir;
     // inode using algorithm for large files
     if (blockNum < TOTAL_BLOCKS_FROM_INDIR) {
         // using indirect blocks
         uint16_t block_addr = inp->i_addr[blockNum / BLOCKS_PER_INDIR];
-        int byteRead = diskimg_readsector(fs->dfd, block_addr, buffer);
-        if (byteRead != DISKIMG_SECTOR_SIZE) {
+        fsstats_count(FSSTATS_INDIRECT_READS, 1);
+        if ((indir = diskimg_getsector(fs->dfd, block_addr, buffer)) == NULL) {
             fprintf(stderr, "Fail to lookup for a file block.\n");
             return -1;
         }
-        return buffer[blockNum % BLOCKS_PER_INDIR];
+        return indir[blockNum % BLOCKS_PER_INDIR];
     } else {
         // doubly indirect block
         blockNum -= TOTAL_BLOCKS_FROM_INDIR;
-        int byteRead = diskimg_readsector(fs->dfd, inp->i_addr[7], buffer);
-        uint16_t block_add = buffer[blockNum / BLOCKS_PER_INDIR];
-        byteRead = diskimg_readsector(fs->dfd, block_add, buffer);
-        return buffer[blockNum % BLOCKS_PER_INDIR];
+        fsstats_count(FSSTATS_INDIRECT_READS, 2);
+        if ((indir = diskimg_getsector(fs->dfd, inp->i_addr[7], buffer)) == NULL) {
+            fprintf(stderr, "Fail to lookup for a file block.\n");
+            return -1;
+        }
+        uint16_t block_add = indir[blockNum / BLOCKS_PER_INDIR];
+        if ((indir = diskimg_getsector(fs->dfd, block_add, buffer)) == NULL) {
+            fprintf(stderr, "Fail to lookup for a file block.\n");
+            return -1;
+        }
+        return indir[blockNum % BLOCKS_PER_INDIR];
     }
     return -1;
 }
 
+int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum) {
+    struct fsstats_span span = fsstats_begin();
+    int block = indexlookup(fs, inp, blockNum);
+    fsstats_end(FSSTATS_INODE_INDEXLOOKUP, span);
+    return block;
+}
+
+int inode_getblockmap(struct unixfilesystem *fs, struct inode *inp, int *blocks, int numBlocks) {
+    if ((inp->i_mode & ILARG) == 0) {
+        // inode using algorithm for small files
+        if (numBlocks > 8) return -1;
+        for (int i = 0; i < numBlocks; i++) blocks[i] = inp->i_addr[i];
+        return 0;
+    }
+
+    // Visit the indirect blocks in order, so that each one is read just once.
+    uint16_t buffer[BLOCKS_PER_INDIR];
+    uint16_t doubleBuffer[BLOCKS_PER_INDIR];
+    const uint16_t *doubly = NULL;
+    for (int first = 0; first < numBlocks; first += BLOCKS_PER_INDIR) {
+        int indirNum = first / BLOCKS_PER_INDIR;
+        int block_addr;
+        if (indirNum < NUM_INDIR_BLOCKS) {
+            block_addr = inp->i_addr[indirNum];
+        } else {
+            if (doubly == NULL) fsstats_count(FSSTATS_INDIRECT_READS, 1);
+            if (doubly == NULL &&
+                (doubly = diskimg_getsector(fs->dfd, inp->i_addr[7], doubleBuffer)) == NULL) {
+                fprintf(stderr, "Fail to lookup for a file block.\n");
+                return -1;
+            }
+            if (indirNum - NUM_INDIR_BLOCKS >= BLOCKS_PER_INDIR) return -1;
+            block_addr = doubly[indirNum - NUM_INDIR_BLOCKS];
+        }
+        fsstats_count(FSSTATS_INDIRECT_READS, 1);
+        const uint16_t *indir = diskimg_getsector(fs->dfd, block_addr, buffer);
+        if (indir == NULL) {
+            fprintf(stderr, "Fail to lookup for a file block.\n");
+            return -1;
+        }
+        for (int i = first; i < numBlocks && i < first + BLOCKS_PER_INDIR; i++) {
+            blocks[i] = indir[i - first];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes count block numbers, padded out with zeros, as an indirect block.
+ */
+static int writeindirect(struct unixfilesystem *fs, int block, const int *blocks, int count) {
+    uint16_t indir[BLOCKS_PER_INDIR];
+    for (int i = 0; i < BLOCKS_PER_INDIR; i++) indir[i] = i < count ? blocks[i] : 0;
+    return diskimg_writesector(fs->dfd, block, indir) == DISKIMG_SECTOR_SIZE ? 0 : -1;
+}
+
+int inode_setblockmap(struct unixfilesystem *fs, struct inode *inp, const int *blocks, int numBlocks) {
+    if (numBlocks < 0 || numBlocks > MAX_FILE_BLOCKS) return -1;
+
+    // Gather up the indirect blocks the inode has now, to use again.
+    int spare[MAX_INDIR_BLOCKS];
+    int numSpare = 0;
+    if (inp->i_mode & ILARG) {
+        for (int i = 0; i < NUM_INDIR_BLOCKS; i++) {
+            if (inp->i_addr[i] != 0) spare[numSpare++] = inp->i_addr[i];
+        }
+        if (inp->i_addr[7] != 0) {
+            uint16_t doubly[BLOCKS_PER_INDIR];
+            fsstats_count(FSSTATS_INDIRECT_READS, 1);
+            if (diskimg_readsector(fs->dfd, inp->i_addr[7], doubly) != DISKIMG_SECTOR_SIZE) return -1;
+            for (int i = 0; i < BLOCKS_PER_INDIR; i++) {
+                if (doubly[i] != 0) spare[numSpare++] = doubly[i];
+            }
+            spare[numSpare++] = inp->i_addr[7];
+        }
+    }
+
+    int numIndir = 0;
+    if (numBlocks > NUM_DIRECT_BLOCKS) {
+        int singly = numBlocks < TOTAL_BLOCKS_FROM_INDIR ? numBlocks : TOTAL_BLOCKS_FROM_INDIR;
+        numIndir = (singly + BLOCKS_PER_INDIR - 1) / BLOCKS_PER_INDIR;
+        if (numBlocks > TOTAL_BLOCKS_FROM_INDIR) {
+            numIndir += 1 + (numBlocks - TOTAL_BLOCKS_FROM_INDIR + BLOCKS_PER_INDIR - 1) / BLOCKS_PER_INDIR;
+        }
+    }
+    int indir[MAX_INDIR_BLOCKS];
+    int numReused = numSpare < numIndir ? numSpare : numIndir;
+    memcpy(indir, spare, numReused * sizeof(int));
+    if (numIndir > numReused && alloc_blocks(fs, numIndir - numReused, indir + numReused) < 0) return -1;
+    if (numSpare > numReused && alloc_freeblocks(fs, spare + numReused, numSpare - numReused) < 0) return -1;
+
+    memset(inp->i_addr, 0, sizeof(inp->i_addr));
+    if (numBlocks <= NUM_DIRECT_BLOCKS) {
+        inp->i_mode &= ~ILARG;
+        for (int i = 0; i < numBlocks; i++) inp->i_addr[i] = blocks[i];
+        return 0;
+    }
+
+    inp->i_mode |= ILARG;
+    int next = 0;
+    for (int first = 0; first < numBlocks; first += BLOCKS_PER_INDIR) {
+        int indirNum = first / BLOCKS_PER_INDIR;
+        if (indirNum == NUM_INDIR_BLOCKS) break;
+        int count = numBlocks - first < BLOCKS_PER_INDIR ? numBlocks - first : BLOCKS_PER_INDIR;
+        inp->i_addr[indirNum] = indir[next];
+        if (writeindirect(fs, indir[next++], blocks + first, count) < 0) return -1;
+    }
+    if (numBlocks > TOTAL_BLOCKS_FROM_INDIR) {
+        int doublyBlock = indir[next++];
+        int doubly[BLOCKS_PER_INDIR];
+        int numDoubly = 0;
+        for (int first = TOTAL_BLOCKS_FROM_INDIR; first < numBlocks; first += BLOCKS_PER_INDIR) {
+            int count = numBlocks - first < BLOCKS_PER_INDIR ? numBlocks - first : BLOCKS_PER_INDIR;
+            doubly[numDoubly++] = indir[next];
+            if (writeindirect(fs, indir[next++], blocks + first, count) < 0) return -1;
+        }
+        inp->i_addr[7] = doublyBlock;
+        if (writeindirect(fs, doublyBlock, doubly, numDoubly) < 0) return -1;
+    }
+    return 0;
+}
+
 int inode_getsize(struct inode *inp) {
     return (inp->i_size1 | (inp->i_size0 << 16));
 }
+
+void inode_setsize(struct inode *inp, int size) {
+    inp->i_size0 = (size >> 16) & 0xff;
+    inp->i_size1 = size & 0xffff;
+}
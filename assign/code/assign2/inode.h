@@ -9,6 +9,46 @@
  */
 int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp); 
 
+/**
+ * Writes the specified inode back to the filesystem, keeping the inode
+ * cache up to date.  Returns 0 on success, -1 on error.
+ */
+int inode_iput(struct unixfilesystem *fs, int inumber, const struct inode *inp);
+
+/**
+ * Makes an inode cache for the filesystem, which inode_iget uses to read
+ * each sector of inodes only once.  It has room for the whole inode region.
+ * Returns NULL if there isn't memory for it.
+ */
+struct inodecache *inode_createcache(struct unixfilesystem *fs);
+
+/**
+ * Releases a cache made by inode_createcache.
+ */
+void inode_freecache(struct inodecache *ic);
+
+/**
+ * A scan visits every allocated inode in inumber order, reading the inode
+ * region chunkSectors sectors at a time, so a full scan reads each sector of
+ * inodes exactly once.  What it reads goes into the inode cache too.  Use it
+ * like this:
+ *
+ *     struct inodescan *scan = inode_scanbegin(fs, 64);
+ *     struct inode in;
+ *     int inumber;
+ *     while ((inumber = inode_scannext(scan, &in)) > 0) { ... }
+ *     inode_scanend(scan);
+ *
+ * inode_scanbegin returns NULL on error.  inode_scannext returns the next
+ * allocated inumber (and copies its inode into inp), 0 once there are no
+ * more, or -1 on error.  inode_scanposition returns the inumber the scan
+ * will look at next, which after an error is where it went wrong.
+ */
+struct inodescan *inode_scanbegin(struct unixfilesystem *fs, int chunkSectors);
+int inode_scannext(struct inodescan *scan, struct inode *inp);
+int inode_scanposition(struct inodescan *scan);
+void inode_scanend(struct inodescan *scan);
+
 /**
  * Given an index of a file block, retrieves the file's actual block number
  * of from the given inode.
@@ -19,9 +59,36 @@ int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum
 
 int inode_indexlookup_indirect(struct unixfilesystem *fs, struct inode *inp, int blockNum);
 
+/**
+ * Resolves the disk block numbers of the file's first numBlocks blocks into
+ * blocks, all at once.  This reads each indirect block just once, rather than
+ * once per block the way repeated calls to inode_indexlookup would.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int inode_getblockmap(struct unixfilesystem *fs, struct inode *inp, int *blocks, int numBlocks);
+
+/**
+ * The reverse of inode_getblockmap: makes the inode's first numBlocks blocks
+ * the ones in blocks, switching between the small and large file layouts as
+ * numBlocks requires.  The indirect blocks the inode already has are reused,
+ * and more are allocated, or any left over freed, as needed; all of them are
+ * written, but the inode itself is only changed in memory, for the caller to
+ * write with inode_iput.
+ *
+ * Returns 0 on success, -1 on error (including a file too big for v6).
+ */
+int inode_setblockmap(struct unixfilesystem *fs, struct inode *inp, const int *blocks, int numBlocks);
+
 /**
  * Computes the size in bytes of the file identified by the given inode
  */
 int inode_getsize(struct inode *inp);
 
+/**
+ * Sets the size in bytes of the file identified by the given inode, which
+ * has to fit in 24 bits.
+ */
+void inode_setsize(struct inode *inp, int size);
+
 #endif // _INODE_
@@ -3,26 +3,37 @@
 #include "directory.h"
 #include "inode.h"
 #include "diskimg.h"
+#include "fsstats.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 #define PATH_SEP "/"
 
-int pathname_lookup(struct unixfilesystem *fs, const char *pathname) {
+static int lookup(struct unixfilesystem *fs, const char *pathname) {
     if (strcmp(pathname, "/") == 0) return ROOT_INUMBER; // root directory
 
     char *filepath = strdup(pathname);
     if (filepath == NULL) return -1;
-    char *token = strsep(&filepath, "/");
-    if (strlen(token) > 0) return -1;
+    char *rest = filepath;
+    char *token = strsep(&rest, "/");
+    int dirinumber = strlen(token) > 0 ? -1 : ROOT_INUMBER;
     
-    int dirinumber = ROOT_INUMBER;
     struct direntv6 dirEnt;
-    while ((token = strsep(&filepath, "/")) != NULL) {
-        if (directory_findname(fs, token, dirinumber, &dirEnt) == -1) return -1;
-        dirinumber = dirEnt.d_inumber;
+    while (dirinumber != -1 && (token = strsep(&rest, "/")) != NULL) {
+        // each step is a name cache probe, once the directory has been searched
+        fsstats_count(FSSTATS_PATH_COMPONENTS, 1);
+        if (directory_findname(fs, token, dirinumber, &dirEnt) == -1) dirinumber = -1;
+        else dirinumber = dirEnt.d_inumber;
     }
+    free(filepath);
     return dirinumber;
 }
 
+int pathname_lookup(struct unixfilesystem *fs, const char *pathname) {
+    struct fsstats_span span = fsstats_begin();
+    int inumber = lookup(fs, pathname);
+    fsstats_end(FSSTATS_PATHNAME_LOOKUP, span);
+    return inumber;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+
+/**
+ * Reads every allocated file on one or more disk images in a few different
+ * ways, and reports how many read system calls each way took per megabyte of
+ * file data.  The sector cache is turned off so that every read counts.
+ */
+
+static char kDefaultImages[][64] = {
+  "slink/testdisks/basicDiskImage",
+  "slink/testdisks/depthFileDiskImage",
+  "slink/testdisks/dirFnameSizeDiskImage",
+};
+
+#define SMALL_READ 100                        // bytes per file_read in the small-read modes
+#define LARGE_READ (64 * DISKIMG_SECTOR_SIZE)  // bytes per file_read in the large-read mode
+
+enum readmode {
+  BY_BLOCK,      // file_getblock, one block at a time, as the code used to
+  LARGE_READS,   // file_read in large pieces, coalescing contiguous blocks
+  SMALL_READS,   // file_read in small pieces, without readahead
+  READAHEAD      // file_read in small pieces, with a readahead window
+};
+
+static const char *kModeNames[] = { "file_getblock", "file_read 32K", "file_read 100B", "readahead 100B" };
+
+/**
+ * Reads the whole of one file the specified way.  Returns the number of
+ * bytes read, or -1 on error.
+ */
+static int ReadFile(struct unixfilesystem *fs, int inumber, enum readmode mode, int window) {
+  char buf[LARGE_READ];
+  if (mode == BY_BLOCK) {
+    struct inode in;
+    if (inode_iget(fs, inumber, &in) < 0) return -1;
+    int size = inode_getsize(&in);
+    for (int bno = 0; bno * DISKIMG_SECTOR_SIZE < size; bno++) {
+      if (file_getblock(fs, inumber, bno, buf) < 0) return -1;
+    }
+    return size;
+  }
+
+  struct file *f = file_open(fs, inumber);
+  if (f == NULL) return -1;
+  if (mode == READAHEAD && file_setreadahead(f, window) < 0) {
+    file_close(f);
+    return -1;
+  }
+  int pieceSize = mode == LARGE_READS ? LARGE_READ : SMALL_READ;
+  int offset = 0;
+  while (offset < f->size) {
+    int bytesRead = file_read(f, offset, buf, pieceSize);
+    if (bytesRead <= 0) break;
+    offset += bytesRead;
+  }
+  int size = f->size;
+  file_close(f);
+  return offset == size ? size : -1;
+}
+
+static void BenchImage(char *diskpath, int window) {
+  int fd = diskimg_open(diskpath, 1);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    return;
+  }
+  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  if (fs == NULL || diskimg_setcachesize(fd, 0) < 0) {
+    fprintf(stderr, "Failed to initialize unix filesystem on %s\n", diskpath);
+    diskimg_close(fd);
+    unixfilesystem_free(fs);
+    return;
+  }
+
+  printf("%s:\n", diskpath);
+  for (enum readmode mode = BY_BLOCK; mode <= READAHEAD; mode++) {
+    struct diskimg_stats before, after;
+    diskimg_getstats(fd, &before);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    double totalBytes = 0;
+    int numFiles = 0, numErrors = 0;
+    for (int inumber = 1; inumber < fs->superblock.s_isize * 16; inumber++) {
+      struct inode in;
+      if (inode_iget(fs, inumber, &in) < 0) break;
+      if ((in.i_mode & IALLOC) == 0) continue;
+      int size = ReadFile(fs, inumber, mode, window);
+      if (size < 0) {
+        numErrors++;
+        continue;
+      }
+      totalBytes += size;
+      numFiles++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    diskimg_getstats(fd, &after);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    double mb = totalBytes / (1024 * 1024);
+    unsigned long reads = after.diskReads - before.diskReads;
+    printf("  %-15s %5d files, %8.2f MB, %8lu reads, %9.1f reads/MB, %8.2f ms",
+           kModeNames[mode], numFiles, mb, reads, mb > 0 ? reads / mb : 0.0, ms);
+    if (numErrors > 0) printf(" (%d files failed)", numErrors);
+    printf("\n");
+  }
+
+  diskimg_close(fd);
+  unixfilesystem_free(fs);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s [-w <window>] [diskimagePath...]\n", progname);
+  fprintf(stderr, "-w <n> readahead window in blocks (default 64)\n");
+  fprintf(stderr, "With no disk images, the ones in slink/testdisks are used.\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int window = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:")) != -1) {
+    if (opt != 'w' || (window = atoi(optarg)) < 1) PrintUsageAndExit(argv[0]);
+  }
+
+  if (optind == argc) {
+    for (size_t i = 0; i < sizeof(kDefaultImages) / sizeof(kDefaultImages[0]); i++) {
+      BenchImage(kDefaultImages[i], window);
+    }
+  } else {
+    for (int i = optind; i < argc; i++) BenchImage(argv[i], window);
+  }
+  return 0;
+}
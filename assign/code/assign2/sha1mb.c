@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sha1mb.h"
+
+#define BLOCK_SIZE 64
+
+// One 32-bit word of SHA-1 state per lane.  GCC splits the arithmetic into
+// as many machine vectors as it takes, so this works whatever the vector
+// width, and compress is built for each width below.
+typedef uint32_t lanes_t __attribute__((vector_size(SHA1MB_LANES * sizeof(uint32_t))));
+
+static const uint32_t kInitialState[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+/**
+ * Where one lane is in its message: the whole blocks of the message itself
+ * are hashed where they are, and what's left over, padded, from tail.
+ */
+struct lane {
+  int message;              // index of the message, or -1 if the lane is idle
+  const uint8_t *data;      // the next whole block of the message
+  int dataBlocks;           // whole blocks of the message left
+  uint8_t tail[2 * BLOCK_SIZE];
+  int tailBlocks;           // blocks of tail (1 or 2)
+  int tailNext;             // the next of them
+};
+
+static void StartLane(struct lane *l, const struct sha1mb_message *m, int index) {
+  int rest = m->length % BLOCK_SIZE;
+  l->message = index;
+  l->data = m->data;
+  l->dataBlocks = m->length / BLOCK_SIZE;
+  memset(l->tail, 0, sizeof(l->tail));
+  if (rest > 0) memcpy(l->tail, l->data + (size_t) l->dataBlocks * BLOCK_SIZE, rest);
+  l->tail[rest] = 0x80;
+  l->tailBlocks = rest + 1 + 8 <= BLOCK_SIZE ? 1 : 2;
+  l->tailNext = 0;
+  uint64_t bits = (uint64_t) m->length * 8;
+  for (int i = 0; i < 8; i++) l->tail[l->tailBlocks * BLOCK_SIZE - 1 - i] = bits >> (8 * i);
+}
+
+/**
+ * Returns the lane's next block, or NULL once it has none left.
+ */
+static const uint8_t *NextBlock(struct lane *l) {
+  if (l->dataBlocks > 0) {
+    const uint8_t *block = l->data;
+    l->data += BLOCK_SIZE;
+    l->dataBlocks--;
+    return block;
+  }
+  return l->tailNext < l->tailBlocks ? l->tail + BLOCK_SIZE * l->tailNext++ : NULL;
+}
+
+static int LaneDone(const struct lane *l) {
+  return l->dataBlocks == 0 && l->tailNext == l->tailBlocks;
+}
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/**
+ * Runs one block through SHA-1 in every lane at once: blocks[l] is lane l's
+ * block, and state[0..4] the lanes' A through E.
+ */
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void Compress(lanes_t *state, const uint8_t *const *blocks) {
+  // Transpose the blocks so that word t of every lane's block is together.
+  uint32_t words[16][SHA1MB_LANES];
+  for (int l = 0; l < SHA1MB_LANES; l++) {
+    for (int t = 0; t < 16; t++) {
+      uint32_t word;
+      memcpy(&word, blocks[l] + 4 * t, sizeof(word));
+      words[t][l] = __builtin_bswap32(word);
+    }
+  }
+  lanes_t w[16];
+  memcpy(w, words, sizeof(w));
+
+  lanes_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (int t = 0; t < 80; t++) {
+    if (t >= 16) {
+      lanes_t x = w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15];
+      w[t & 15] = ROL(x, 1);
+    }
+    lanes_t f;
+    uint32_t k;
+    if (t < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (t < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (t < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    lanes_t temp = ROL(a, 5) + f + e + k + w[t & 15];
+    e = d;
+    d = c;
+    c = ROL(b, 30);
+    b = a;
+    a = temp;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void sha1mb_digest(struct sha1mb_message *messages, int numMessages) {
+  static const uint8_t kIdleBlock[BLOCK_SIZE];
+  struct lane lanes[SHA1MB_LANES];
+  lanes_t state[5];
+  int nextMessage = 0, numActive = 0;
+  for (int l = 0; l < SHA1MB_LANES; l++) {
+    lanes[l].message = -1;
+    if (nextMessage < numMessages) {
+      StartLane(&lanes[l], &messages[nextMessage], nextMessage);
+      nextMessage++;
+      numActive++;
+    }
+    for (int i = 0; i < 5; i++) state[i][l] = kInitialState[i];
+  }
+
+  while (numActive > 0) {
+    const uint8_t *blocks[SHA1MB_LANES];
+    for (int l = 0; l < SHA1MB_LANES; l++) {
+      blocks[l] = lanes[l].message >= 0 ? NextBlock(&lanes[l]) : kIdleBlock;
+    }
+    Compress(state, blocks);
+
+    for (int l = 0; l < SHA1MB_LANES; l++) {
+      struct lane *lane = &lanes[l];
+      if (lane->message < 0 || !LaneDone(lane)) continue;
+      unsigned char *digest = messages[lane->message].digest;
+      for (int i = 0; i < 5; i++) {
+        uint32_t word = state[i][l];
+        digest[4 * i] = word >> 24;
+        digest[4 * i + 1] = word >> 16;
+        digest[4 * i + 2] = word >> 8;
+        digest[4 * i + 3] = word;
+        state[i][l] = kInitialState[i];
+      }
+      lane->message = -1;
+      numActive--;
+      if (nextMessage < numMessages) {
+        StartLane(lane, &messages[nextMessage], nextMessage);
+        nextMessage++;
+        numActive++;
+      }
+    }
+  }
+}
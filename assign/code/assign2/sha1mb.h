@@ -0,0 +1,30 @@
+#ifndef _SHA1MB_H_
+#define _SHA1MB_H_
+
+/**
+ * Multi-buffer SHA-1: many messages hashed together, SHA1MB_LANES of them at
+ * a time, one in each lane of a vector, so that one pass through the SHA-1
+ * rounds advances them all by a block.  A lane whose message is done takes
+ * the next one straight away, so messages of different lengths keep every
+ * lane busy until there are no more to start.  The digests are the same as
+ * SHA1 would give for each message on its own.
+ *
+ * This pays off for lots of small messages, where hashing one at a time
+ * spends as much on setting up and padding each message as on its data.
+ */
+
+#define SHA1MB_LANES 16
+#define SHA1MB_DIGEST_SIZE 20
+
+struct sha1mb_message {
+  const void *data;
+  int length;               // bytes of data
+  unsigned char *digest;    // where its SHA1MB_DIGEST_SIZE byte digest goes
+};
+
+/**
+ * Computes the digests of numMessages messages.
+ */
+void sha1mb_digest(struct sha1mb_message *messages, int numMessages);
+
+#endif // _SHA1MB_H_
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include "unixfilesystem.h"
 #include "diskimg.h" 
+#include "dcache.h"
+#include "inode.h"
 
 /**
  * Allocates and initializes a struct unixfilesystem given a filedescriptor to 
@@ -35,11 +38,39 @@ struct unixfilesystem *unixfilesystem_init(int dfd) {
   }
 
   fs->dfd = dfd;  
+  fs->superblockDirty = 0;
   if (diskimg_readsector(dfd, SUPERBLOCK_SECTOR, &fs->superblock) != DISKIMG_SECTOR_SIZE) {
     fprintf(stderr, "Error reading superblock\n");
     free(fs);
     return NULL;
   }
 
+  // Without memory for these caches, everything is just read every time.
+  fs->dcache = dcache_create();
+  fs->icache = inode_createcache(fs);
   return fs;
 }
+
+int unixfilesystem_flush(struct unixfilesystem *fs) {
+  int err = 0;
+  if (fs->superblockDirty) {
+    time_t now = time(NULL);
+    fs->superblock.s_fmod = 0;
+    fs->superblock.s_time[0] = now >> 16;
+    fs->superblock.s_time[1] = now & 0xffff;
+    if (diskimg_writesector(fs->dfd, SUPERBLOCK_SECTOR, &fs->superblock) != DISKIMG_SECTOR_SIZE) {
+      err = -1;
+    } else {
+      fs->superblockDirty = 0;
+    }
+  }
+  if (diskimg_flush(fs->dfd) < 0) err = -1;
+  return err;
+}
+
+void unixfilesystem_free(struct unixfilesystem *fs) {
+  if (fs == NULL) return;
+  dcache_free(fs->dcache);
+  inode_freecache(fs->icache);
+  free(fs);
+}
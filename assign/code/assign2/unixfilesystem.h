@@ -25,11 +25,30 @@
 #define ROOT_INUMBER        1
 #define BOOTBLOCK_MAGIC_NUM 0407
 
+struct dcache;
+struct inodecache;
+
 struct unixfilesystem {
   int dfd; // Handle from the diskimg module to read the diskimg.
   struct filsys superblock;  // The superblock read from the diskimage.
+  struct dcache *dcache;     // Names already found in directories, or NULL.
+  struct inodecache *icache; // Inodes already read, or NULL.
+  int superblockDirty;       // Whether superblock has changed since it was read.
 };
 
 struct unixfilesystem *unixfilesystem_init(int fd);
 
+/**
+ * Writes everything the filesystem has changed out to the disk image: the
+ * superblock, if allocation has changed it, and whatever the image's sector
+ * cache is holding back.  Returns 0 on success, or -1 on error.
+ */
+int unixfilesystem_flush(struct unixfilesystem *fs);
+
+/**
+ * Releases a struct unixfilesystem made by unixfilesystem_init.  The disk
+ * image is left open.
+ */
+void unixfilesystem_free(struct unixfilesystem *fs);
+
 #endif // _UNIXFILESYSTEM_H_
@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+
+/**
+ * Checks a disk image for consistency, the way fsck does, reading each part
+ * of it once:
+ *
+ *   1. The inode table is read front to back with an inode scan.
+ *   2. Every block an allocated inode owns, indirect blocks included, is
+ *      marked in a bitmap, many inodes at a time across threads.  A block
+ *      marked twice is owned more than once; the owners are looked for
+ *      afterwards, only if there are any.
+ *   3. Every directory is read, again across threads, counting the entries
+ *      that name each inode.
+ *   4. The directories are walked from the root to find the allocated inodes
+ *      that can't be reached (orphans), and the counts from 3 are compared
+ *      with the link counts.
+ *   5. The free list is walked and checked against the bitmap, which leaves
+ *      the blocks that are neither in use nor free (leaks).
+ *
+ * Problems are printed one per line, in inumber or block order, followed by
+ * a summary of what was checked and how long each pass took.  The exit
+ * status is 0 if nothing was wrong, 1 if something was, and 2 if the image
+ * couldn't be checked at all.
+ */
+
+#define INODES_PER_SECTOR (DISKIMG_SECTOR_SIZE / sizeof(struct inode))
+#define BLOCKS_PER_INDIR (DISKIMG_SECTOR_SIZE / sizeof(uint16_t))
+#define NUM_INDIR_BLOCKS 7        // singly indirect blocks in a large file's i_addr
+#define NUM_DIRECT_BLOCKS 8       // blocks in a small file's i_addr
+#define FREE_PER_SUPERBLOCK 100   // entries in s_free
+#define SCAN_CHUNK_SECTORS 64     // inode table sectors read at a time
+#define INODES_PER_ITEM 256       // inodes each thread claims at a time in pass 2
+
+/**
+ * What turned up about one inode's blocks in pass 2.
+ */
+struct blockcheck {
+  int badBlocks;    // block numbers outside the data area
+  int broken;       // an indirect block couldn't be read, or the size doesn't fit the layout
+};
+
+/**
+ * One directory's entries, read in pass 3.
+ */
+struct dirinfo {
+  int inumber;
+  struct direntv6 *entries;
+  int numEntries;
+  int failed;       // couldn't be read
+};
+
+struct fsck {
+  struct unixfilesystem *fs;
+  int numInodes;
+  int firstDataBlock;
+  int numBlocks;
+
+  struct inode *inodes;     // indexed by inumber
+  int *allocated;           // the allocated inumbers, in order
+  int numAllocated;
+  struct blockcheck *blockChecks;   // indexed by position in allocated
+
+  uint64_t *used;           // blocks some inode owns
+  uint64_t *ownedTwice;     // blocks more than one inode owns (or one inode twice)
+  uint64_t *free;           // blocks on the free list
+
+  struct dirinfo *dirs;     // the allocated directories, in inumber order
+  int numDirs;
+  int *dirIndex;            // index into dirs by inumber, or -1
+  int *refs;                // directory entries naming each inumber
+  char *reachable;          // whether each inumber can be reached from the root
+
+  int numProblems;
+  int quiet;                // count problems without printing them
+};
+
+static int numThreads = 4;
+
+/**
+ * Prints one problem, unless the check is quiet, and counts it either way.
+ */
+static void Problem(struct fsck *c, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void Problem(struct fsck *c, const char *format, ...) {
+  c->numProblems++;
+  if (c->quiet) return;
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  printf("\n");
+}
+
+static int IsSet(const uint64_t *bitmap, int block) {
+  return (bitmap[block / 64] >> (block % 64)) & 1;
+}
+
+static int InDataArea(struct fsck *c, int block) {
+  return block >= c->firstDataBlock && block < c->numBlocks;
+}
+
+static int IsDirectory(const struct inode *in) {
+  return (in->i_mode & IALLOC) && (in->i_mode & IFMT) == IFDIR;
+}
+
+/**
+ * Calls work(context, item) for every item in [0, numItems), spread across
+ * numThreads threads, the calling thread included.
+ */
+struct parallelrun {
+  void (*work)(void *context, int item);
+  void *context;
+  int numItems;
+  int next;
+};
+
+static void *ParallelWorker(void *arg) {
+  struct parallelrun *run = arg;
+  int item;
+  while ((item = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->numItems) {
+    run->work(run->context, item);
+  }
+  return NULL;
+}
+
+static void RunInParallel(int numItems, void (*work)(void *, int), void *context) {
+  struct parallelrun run = { work, context, numItems, 0 };
+  pthread_t threads[numThreads];
+  int numStarted = 0;
+  while (numStarted < numThreads - 1 && numStarted < numItems &&
+         pthread_create(&threads[numStarted], NULL, ParallelWorker, &run) == 0) {
+    numStarted++;
+  }
+  ParallelWorker(&run);
+  for (int t = 0; t < numStarted; t++) pthread_join(threads[t], NULL);
+}
+
+/**
+ * Calls visit(c, inumber, block) for every block the inode owns, data and
+ * indirect blocks both, and fills in check.  Block numbers outside the data
+ * area aren't visited (or read), and 0 is a hole.
+ */
+static void VisitBlocks(struct fsck *c, int inumber, struct blockcheck *check,
+                        void (*visit)(struct fsck *, int, int)) {
+  struct inode *in = &c->inodes[inumber];
+  int numBlocks = (inode_getsize(in) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  check->badBlocks = 0;
+  check->broken = 0;
+
+  if ((in->i_mode & ILARG) == 0) {
+    if (numBlocks > NUM_DIRECT_BLOCKS) {
+      check->broken = 1;
+      numBlocks = NUM_DIRECT_BLOCKS;
+    }
+    for (int i = 0; i < numBlocks; i++) {
+      int block = in->i_addr[i];
+      if (block == 0) continue;
+      if (!InDataArea(c, block)) {
+        check->badBlocks++;
+        continue;
+      }
+      visit(c, inumber, block);
+    }
+    return;
+  }
+
+  uint16_t buffer[BLOCKS_PER_INDIR];
+  uint16_t doubleBuffer[BLOCKS_PER_INDIR];
+  const uint16_t *doubly = NULL;
+  int numIndir = (numBlocks + BLOCKS_PER_INDIR - 1) / BLOCKS_PER_INDIR;
+  if (numIndir > NUM_INDIR_BLOCKS + (int) BLOCKS_PER_INDIR) {
+    check->broken = 1;
+    numIndir = NUM_INDIR_BLOCKS + BLOCKS_PER_INDIR;
+  }
+  for (int i = 0; i < numIndir; i++) {
+    int indir;
+    if (i < NUM_INDIR_BLOCKS) {
+      indir = in->i_addr[i];
+    } else {
+      if (doubly == NULL) {
+        int block = in->i_addr[7];
+        if (block == 0) break;
+        if (!InDataArea(c, block)) {
+          check->badBlocks++;
+          break;
+        }
+        visit(c, inumber, block);
+        if ((doubly = diskimg_getsector(c->fs->dfd, block, doubleBuffer)) == NULL) {
+          check->broken = 1;
+          break;
+        }
+      }
+      indir = doubly[i - NUM_INDIR_BLOCKS];
+    }
+    if (indir == 0) continue;
+    if (!InDataArea(c, indir)) {
+      check->badBlocks++;
+      continue;
+    }
+    visit(c, inumber, indir);
+
+    const uint16_t *entries = diskimg_getsector(c->fs->dfd, indir, buffer);
+    if (entries == NULL) {
+      check->broken = 1;
+      continue;
+    }
+    int count = numBlocks - i * BLOCKS_PER_INDIR;
+    if (count > (int) BLOCKS_PER_INDIR) count = BLOCKS_PER_INDIR;
+    for (int j = 0; j < count; j++) {
+      int block = entries[j];
+      if (block == 0) continue;
+      if (!InDataArea(c, block)) {
+        check->badBlocks++;
+        continue;
+      }
+      visit(c, inumber, block);
+    }
+  }
+}
+
+static void MarkUsed(struct fsck *c, int inumber, int block) {
+  uint64_t bit = (uint64_t) 1 << (block % 64);
+  if (__atomic_fetch_or(&c->used[block / 64], bit, __ATOMIC_RELAXED) & bit) {
+    __atomic_fetch_or(&c->ownedTwice[block / 64], bit, __ATOMIC_RELAXED);
+  }
+}
+
+static void ReportOwnedTwice(struct fsck *c, int inumber, int block) {
+  if (IsSet(c->ownedTwice, block)) Problem(c, "Block %d is owned by inode %d and another", block, inumber);
+}
+
+static void CheckBlocks(void *context, int item) {
+  struct fsck *c = context;
+  int last = (item + 1) * INODES_PER_ITEM;
+  if (last > c->numAllocated) last = c->numAllocated;
+  for (int i = item * INODES_PER_ITEM; i < last; i++) {
+    VisitBlocks(c, c->allocated[i], &c->blockChecks[i], MarkUsed);
+  }
+}
+
+static void ReadDirectory(void *context, int item) {
+  struct fsck *c = context;
+  struct dirinfo *dir = &c->dirs[item];
+  struct file *f = file_open(c->fs, dir->inumber);
+  if (f == NULL || f->size % sizeof(struct direntv6) != 0 ||
+      (dir->entries = malloc(f->size)) == NULL ||
+      file_read(f, 0, dir->entries, f->size) != f->size) {
+    dir->failed = 1;
+    if (f != NULL) file_close(f);
+    return;
+  }
+  dir->numEntries = f->size / sizeof(struct direntv6);
+  file_close(f);
+
+  for (int i = 0; i < dir->numEntries; i++) {
+    int inumber = dir->entries[i].d_inumber;
+    if (inumber > 0 && inumber <= c->numInodes) __atomic_fetch_add(&c->refs[inumber], 1, __ATOMIC_RELAXED);
+  }
+}
+
+static int IsDotOrDotDot(const struct direntv6 *entry) {
+  return strncmp(entry->d_name, ".", sizeof(entry->d_name)) == 0 ||
+         strncmp(entry->d_name, "..", sizeof(entry->d_name)) == 0;
+}
+
+/**
+ * Marks everything that can be reached from the root, one directory at a
+ * time, breadth first.
+ */
+static void WalkTree(struct fsck *c) {
+  int *queue = malloc((c->numDirs + 1) * sizeof(int));
+  if (queue == NULL) return;
+  int head = 0, tail = 0;
+  c->reachable[ROOT_INUMBER] = 1;
+  if (c->dirIndex[ROOT_INUMBER] >= 0) queue[tail++] = ROOT_INUMBER;
+  while (head < tail) {
+    struct dirinfo *dir = &c->dirs[c->dirIndex[queue[head++]]];
+    for (int i = 0; i < dir->numEntries; i++) {
+      int inumber = dir->entries[i].d_inumber;
+      if (inumber <= 0 || inumber > c->numInodes || IsDotOrDotDot(&dir->entries[i])) continue;
+      if (c->reachable[inumber] || !(c->inodes[inumber].i_mode & IALLOC)) continue;
+      c->reachable[inumber] = 1;
+      if (c->dirIndex[inumber] >= 0) queue[tail++] = inumber;
+    }
+  }
+  free(queue);
+}
+
+static void CheckDirectories(struct fsck *c) {
+  for (int d = 0; d < c->numDirs; d++) {
+    struct dirinfo *dir = &c->dirs[d];
+    if (dir->failed) {
+      Problem(c, "Directory %d can't be read", dir->inumber);
+      continue;
+    }
+    for (int i = 0; i < dir->numEntries; i++) {
+      const struct direntv6 *entry = &dir->entries[i];
+      int inumber = entry->d_inumber;
+      if (inumber == 0) continue;
+      if (inumber > c->numInodes) {
+        Problem(c, "Directory %d entry %.14s names inode %d, past the end of the inode table",
+                dir->inumber, entry->d_name, inumber);
+      } else if (!(c->inodes[inumber].i_mode & IALLOC)) {
+        Problem(c, "Directory %d entry %.14s names inode %d, which isn't allocated",
+                dir->inumber, entry->d_name, inumber);
+      } else if (strncmp(entry->d_name, ".", sizeof(entry->d_name)) == 0 && inumber != dir->inumber) {
+        Problem(c, "Directory %d entry . names inode %d", dir->inumber, inumber);
+      }
+    }
+  }
+}
+
+static void CheckInodes(struct fsck *c) {
+  for (int i = 0; i < c->numAllocated; i++) {
+    int inumber = c->allocated[i];
+    struct inode *in = &c->inodes[inumber];
+    struct blockcheck *check = &c->blockChecks[i];
+    if (check->badBlocks > 0) {
+      Problem(c, "Inode %d has %d block numbers outside the data area", inumber, check->badBlocks);
+    }
+    if (check->broken) {
+      Problem(c, "Inode %d (size %d) has blocks that can't be found", inumber, inode_getsize(in));
+    }
+    if (!c->reachable[inumber]) {
+      if (c->refs[inumber] == 0) {
+        Problem(c, "Inode %d (mode 0x%x, size %d) is in no directory", inumber, in->i_mode, inode_getsize(in));
+      } else {
+        Problem(c, "Inode %d (mode 0x%x, size %d) can't be reached from the root",
+                inumber, in->i_mode, inode_getsize(in));
+      }
+    }
+    if (c->refs[inumber] != in->i_nlink) {
+      Problem(c, "Inode %d has link count %d but %d directory entries", inumber, in->i_nlink, c->refs[inumber]);
+    }
+  }
+}
+
+/**
+ * Walks the free list, from the superblock down the chain, marking the
+ * blocks on it.  Returns how many there are.
+ */
+static int WalkFreeList(struct fsck *c) {
+  const struct filsys *sb = &c->fs->superblock;
+  uint16_t chain[BLOCKS_PER_INDIR];
+  int nfree = sb->s_nfree;
+  const uint16_t *list = sb->s_free;
+  int numFree = 0;
+  while (1) {
+    if (nfree > FREE_PER_SUPERBLOCK) {
+      Problem(c, "The free list has a link with %d blocks on it", nfree);
+      break;
+    }
+    if (nfree == 0) break;
+    int block = list[--nfree];
+    if (block == 0) break;
+    if (!InDataArea(c, block)) {
+      Problem(c, "Block %d is on the free list but outside the data area", block);
+      if (nfree == 0) break;
+      continue;
+    }
+    if (IsSet(c->free, block)) {
+      Problem(c, "Block %d is on the free list twice", block);
+      if (nfree == 0) break;  // following it again would go round in circles
+      continue;
+    }
+    c->free[block / 64] |= (uint64_t) 1 << (block % 64);
+    numFree++;
+    if (IsSet(c->used, block)) Problem(c, "Block %d is on the free list but in use", block);
+    if (nfree == 0) {
+      if (diskimg_readsector(c->fs->dfd, block, chain) != DISKIMG_SECTOR_SIZE) {
+        Problem(c, "Block %d, a link in the free list, can't be read", block);
+        break;
+      }
+      nfree = chain[0];
+      list = chain + 1;
+    }
+  }
+
+  for (int i = 0; i < sb->s_ninode && i < FREE_PER_SUPERBLOCK; i++) {
+    int inumber = sb->s_inode[i];
+    if (inumber < 1 || inumber > c->numInodes || (c->inodes[inumber].i_mode & IALLOC)) {
+      Problem(c, "The superblock lists inode %d as free", inumber);
+    }
+  }
+  return numFree;
+}
+
+/**
+ * Reports the blocks that are neither in use nor free, a run at a time.
+ * Returns how many there are.
+ */
+static int FindLeaks(struct fsck *c) {
+  int numLeaked = 0;
+  for (int block = c->firstDataBlock; block < c->numBlocks; block++) {
+    if (IsSet(c->used, block) || IsSet(c->free, block)) continue;
+    int last = block;
+    while (last + 1 < c->numBlocks && !IsSet(c->used, last + 1) && !IsSet(c->free, last + 1)) last++;
+    if (last == block) {
+      Problem(c, "Block %d is neither in use nor free", block);
+    } else {
+      Problem(c, "Blocks %d-%d are neither in use nor free", block, last);
+    }
+    numLeaked += last - block + 1;
+    block = last;
+  }
+  return numLeaked;
+}
+
+/**
+ * Times one pass: how long it took and how much it read.
+ */
+struct passtime {
+  const char *name;
+  struct timespec start;
+  struct diskimg_stats before;
+  double ms;
+  unsigned long reads;
+  unsigned long sectors;
+  int items;
+  const char *itemName;
+};
+
+static void BeginPass(struct fsck *c, struct passtime *p, const char *name, const char *itemName) {
+  p->name = name;
+  p->itemName = itemName;
+  diskimg_getstats(c->fs->dfd, &p->before);
+  clock_gettime(CLOCK_MONOTONIC, &p->start);
+}
+
+static void EndPass(struct fsck *c, struct passtime *p, int items) {
+  struct timespec end;
+  struct diskimg_stats after;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  diskimg_getstats(c->fs->dfd, &after);
+  p->ms = (end.tv_sec - p->start.tv_sec) * 1e3 + (end.tv_nsec - p->start.tv_nsec) / 1e6;
+  p->reads = after.diskReads - p->before.diskReads;
+  p->sectors = (after.diskBytes - p->before.diskBytes) / DISKIMG_SECTOR_SIZE;
+  p->items = items;
+}
+
+static void PrintPass(const struct passtime *p) {
+  printf("  %-12s %9.2f ms %8d %-12s %10.0f/s %8lu reads %8lu sectors\n", p->name, p->ms,
+         p->items, p->itemName, p->ms > 0 ? p->items / (p->ms / 1e3) : 0.0, p->reads, p->sectors);
+}
+
+static int CheckImage(struct fsck *c, char *diskpath) {
+  struct unixfilesystem *fs = c->fs;
+  c->numInodes = fs->superblock.s_isize * INODES_PER_SECTOR;
+  c->firstDataBlock = INODE_START_SECTOR + fs->superblock.s_isize;
+  c->numBlocks = fs->superblock.s_fsize;
+  int bitmapWords = c->numBlocks / 64 + 1;
+  c->inodes = calloc(c->numInodes + 1, sizeof(struct inode));
+  c->allocated = malloc(c->numInodes * sizeof(int));
+  c->used = calloc(bitmapWords, sizeof(uint64_t));
+  c->ownedTwice = calloc(bitmapWords, sizeof(uint64_t));
+  c->free = calloc(bitmapWords, sizeof(uint64_t));
+  c->dirIndex = malloc((c->numInodes + 1) * sizeof(int));
+  c->refs = calloc(c->numInodes + 1, sizeof(int));
+  c->reachable = calloc(c->numInodes + 1, 1);
+  if (c->inodes == NULL || c->allocated == NULL || c->used == NULL || c->ownedTwice == NULL ||
+      c->free == NULL || c->dirIndex == NULL || c->refs == NULL || c->reachable == NULL) {
+    fprintf(stderr, "Not enough memory to check %s\n", diskpath);
+    return -1;
+  }
+  struct passtime passes[5];
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Pass 1: the inode table.
+  BeginPass(c, &passes[0], "inodes", "inodes");
+  struct inodescan *scan = inode_scanbegin(fs, SCAN_CHUNK_SECTORS);
+  if (scan == NULL) {
+    fprintf(stderr, "Can't scan the inodes of %s\n", diskpath);
+    return -1;
+  }
+  struct inode in;
+  int inumber;
+  while ((inumber = inode_scannext(scan, &in)) > 0) {
+    c->inodes[inumber] = in;
+    c->allocated[c->numAllocated++] = inumber;
+    if (IsDirectory(&in)) c->numDirs++;
+  }
+  if (inumber < 0) {
+    fprintf(stderr, "Can't read the inode table of %s (at inode %d)\n", diskpath, inode_scanposition(scan));
+    inode_scanend(scan);
+    return -1;
+  }
+  inode_scanend(scan);
+  EndPass(c, &passes[0], c->numInodes);
+
+  // Pass 2: who owns what.
+  BeginPass(c, &passes[1], "blocks", "inodes");
+  c->blockChecks = calloc(c->numAllocated + 1, sizeof(struct blockcheck));
+  c->dirs = calloc(c->numDirs + 1, sizeof(struct dirinfo));
+  if (c->blockChecks == NULL || c->dirs == NULL) {
+    fprintf(stderr, "Not enough memory to check %s\n", diskpath);
+    return -1;
+  }
+  RunInParallel((c->numAllocated + INODES_PER_ITEM - 1) / INODES_PER_ITEM, CheckBlocks, c);
+  int anyOwnedTwice = 0;
+  for (int w = 0; w < bitmapWords; w++) anyOwnedTwice |= c->ownedTwice[w] != 0;
+  if (anyOwnedTwice) {
+    struct blockcheck check;
+    for (int i = 0; i < c->numAllocated; i++) VisitBlocks(c, c->allocated[i], &check, ReportOwnedTwice);
+  }
+  EndPass(c, &passes[1], c->numAllocated);
+
+  // Pass 3: the directories.
+  BeginPass(c, &passes[2], "directories", "directories");
+  int numDirs = 0;
+  for (int i = 1; i <= c->numInodes; i++) {
+    c->dirIndex[i] = -1;
+    if (IsDirectory(&c->inodes[i])) {
+      c->dirIndex[i] = numDirs;
+      c->dirs[numDirs++].inumber = i;
+    }
+  }
+  RunInParallel(c->numDirs, ReadDirectory, c);
+  EndPass(c, &passes[2], c->numDirs);
+
+  // Pass 4: reachability and link counts.
+  BeginPass(c, &passes[3], "tree", "inodes");
+  if (!IsDirectory(&c->inodes[ROOT_INUMBER])) Problem(c, "The root, inode %d, isn't a directory", ROOT_INUMBER);
+  WalkTree(c);
+  CheckDirectories(c);
+  CheckInodes(c);
+  EndPass(c, &passes[3], c->numAllocated);
+
+  // Pass 5: the free list.
+  BeginPass(c, &passes[4], "free list", "blocks");
+  int numFree = WalkFreeList(c);
+  int numLeaked = FindLeaks(c);
+  EndPass(c, &passes[4], numFree);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  int numUsed = 0;
+  for (int w = 0; w < bitmapWords; w++) numUsed += __builtin_popcountll(c->used[w]);
+  printf("%s: %d inodes (%d allocated, %d directories), %d data blocks (%d in use, %d free, %d leaked)\n",
+         diskpath, c->numInodes, c->numAllocated, c->numDirs, c->numBlocks - c->firstDataBlock,
+         numUsed, numFree, numLeaked);
+  printf("%d problem%s found\n", c->numProblems, c->numProblems == 1 ? "" : "s");
+  double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  unsigned long sectors = 0;
+  for (int p = 0; p < 5; p++) sectors += passes[p].sectors;
+  printf("Passes (%d thread%s), %.2f ms in all, %.2f MB/s read:\n", numThreads, numThreads == 1 ? "" : "s",
+         ms, ms > 0 ? sectors * DISKIMG_SECTOR_SIZE / (1024.0 * 1024.0) / (ms / 1e3) : 0.0);
+  for (int p = 0; p < 5; p++) PrintPass(&passes[p]);
+  return 0;
+}
+
+static void FreeCheck(struct fsck *c) {
+  for (int d = 0; c->dirs != NULL && d < c->numDirs; d++) free(c->dirs[d].entries);
+  free(c->dirs);
+  free(c->inodes);
+  free(c->allocated);
+  free(c->blockChecks);
+  free(c->used);
+  free(c->ownedTwice);
+  free(c->free);
+  free(c->dirIndex);
+  free(c->refs);
+  free(c->reachable);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s [-q] [-m] [-j <threads>] diskimagePath\n", progname);
+  fprintf(stderr, "-q only count the problems found, without listing them\n");
+  fprintf(stderr, "-m map the image into memory rather than reading it\n");
+  fprintf(stderr, "-j <n> use n threads for the block and directory passes (default 4)\n");
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  int quietFlag = 0, mapFlag = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "qmj:")) != -1) {
+    switch (opt) {
+    case 'q':
+      quietFlag = 1;
+      break;
+    case 'm':
+      mapFlag = 1;
+      break;
+    case 'j':
+      numThreads = atoi(optarg);
+      if (numThreads < 1) PrintUsageAndExit(argv[0]);
+      break;
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc - 1) PrintUsageAndExit(argv[0]);
+
+  char *diskpath = argv[optind];
+  int fd = diskimg_openbackend(diskpath, 1, mapFlag ? DISKIMG_MAPPED : DISKIMG_BUFFERED);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    exit(2);
+  }
+  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  if (fs == NULL) {
+    fprintf(stderr, "Failed to initialize unix filesystem on %s\n", diskpath);
+    (void) diskimg_close(fd);
+    exit(2);
+  }
+
+  struct fsck c = { .fs = fs, .quiet = quietFlag };
+  int err = CheckImage(&c, diskpath);
+  FreeCheck(&c);
+  unixfilesystem_free(fs);
+  (void) diskimg_close(fd);
+  if (err < 0) exit(2);
+  exit(c.numProblems > 0 ? 1 : 0);
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+
+/**
+ * Checks the write path on a scratch disk image (one made by gen-image, say;
+ * it gets changed): overwriting a file in place has to leave its size alone,
+ * change its data, and give it a new i_mtime, on disk as well as in memory.
+ * And making subdirectories has to stop short of overflowing their parent's
+ * one-byte link count.
+ */
+
+static int failures = 0;
+
+static void Check(int ok, const char *what) {
+  printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+  if (!ok) failures++;
+}
+
+static int Mtime(const struct inode *in) {
+  return (in->i_mtime[0] << 16) | in->i_mtime[1];
+}
+
+/**
+ * Opens the image and finds its first allocated regular file that isn't
+ * empty.  Returns its inumber, or -1.
+ */
+static int FindFile(struct unixfilesystem *fs) {
+  struct inodescan *scan = inode_scanbegin(fs, 64);
+  if (scan == NULL) return -1;
+  struct inode in;
+  int inumber;
+  while ((inumber = inode_scannext(scan, &in)) > 0) {
+    if ((in.i_mode & IFMT) == 0 && inode_getsize(&in) > 0) break;
+  }
+  inode_scanend(scan);
+  return inumber > 0 ? inumber : -1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s scratchDiskimagePath\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  int fd = diskimg_open(argv[1], 0);
+  struct unixfilesystem *fs = fd < 0 ? NULL : unixfilesystem_init(fd);
+  int inumber = fs == NULL ? -1 : FindFile(fs);
+  if (inumber < 0 || diskimg_setwriteback(fd, 1) < 0) {
+    fprintf(stderr, "Can't find a file to write on %s\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Backdate the file, so that any new i_mtime is later.
+  struct inode before;
+  inode_iget(fs, inumber, &before);
+  before.i_mtime[0] = before.i_mtime[1] = 0;
+  Check(inode_iput(fs, inumber, &before) == 0, "backdate the inode");
+
+  struct file *f = file_open(fs, inumber);
+  char old, new;
+  Check(f != NULL && file_read(f, 0, &old, 1) == 1, "read the first byte");
+  new = ~old;
+  Check(file_write(f, 0, &new, 1) == 1, "overwrite it in place");
+  Check(file_sync(f) == 0, "sync");
+  file_close(f);
+
+  struct inode after;
+  inode_iget(fs, inumber, &after);
+  Check(Mtime(&after) > 0, "i_mtime advances");
+  Check(inode_getsize(&after) == inode_getsize(&before), "size unchanged");
+
+  // A directory starts with 2 links, and each subdirectory's ".." adds one.
+  int dirinumber = file_create(fs, "/many", IFDIR | 0755);
+  int numSubdirs = 0;
+  while (dirinumber > 0 && numSubdirs < 300) {
+    char path[32];
+    sprintf(path, "/many/d%d", numSubdirs);
+    if (file_create(fs, path, IFDIR | 0755) < 0) break;
+    numSubdirs++;
+  }
+  struct inode dir;
+  Check(dirinumber > 0 && numSubdirs == 253, "subdirectories stop at 253");
+  Check(dirinumber > 0 && inode_iget(fs, dirinumber, &dir) == 0 && dir.i_nlink == 255, "link count stops at 255");
+  Check(unixfilesystem_flush(fs) == 0, "flush");
+  unixfilesystem_free(fs);
+  Check(diskimg_close(fd) == 0, "close");
+
+  // Everything should be the same read back from the image.
+  fd = diskimg_open(argv[1], 1);
+  fs = fd < 0 ? NULL : unixfilesystem_init(fd);
+  Check(fs != NULL && inode_iget(fs, inumber, &after) == 0, "reopen");
+  if (fs != NULL) {
+    char c = old;
+    f = file_open(fs, inumber);
+    Check(f != NULL && file_read(f, 0, &c, 1) == 1 && c == new, "new byte on disk");
+    if (f != NULL) file_close(f);
+    Check(Mtime(&after) > 0, "i_mtime on disk advanced");
+    Check(inode_getsize(&after) == inode_getsize(&before), "size on disk unchanged");
+    unixfilesystem_free(fs);
+    diskimg_close(fd);
+  }
+
+  printf("%s\n", failures == 0 ? "All passed" : "Some failed");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}